@@ -0,0 +1,264 @@
+"""
+Benchmarks of the semprpy bindings.
+
+Every benchmark builds its input with a synthetic generator, is run a number
+of times at several sizes, and reports the time of each run. The results are
+printed and written as JSON, so they can be compared across commits:
+
+    python bench/bench.py --output results.json
+    python bench/bench.py --filter inference --scale 0.1 --repeat 3
+
+Needs the semprpy module on the python path, e.g. from `make bench` in the
+cmake build directory or `python setup.py bench`.
+"""
+
+import argparse
+import json
+import platform
+import statistics
+import sys
+import time
+
+import semprpy as sempr
+from semprpy import rdf, rdfs
+
+
+# --- generators --------------------------------------------------------------
+
+def subclassRules():
+    # same as in test/test_inference.py
+    return f"""
+    @PREFIX rdfs: <{rdfs.baseURI()}>
+    @PREFIX rdf: <{rdf.baseURI()}>
+
+    [subclass:
+        (?a rdfs:subClassOf ?b)
+        [transitive:
+            (?b rdfs:subClassOf ?c) -> (?a rdfs:subClassOf ?c)]
+        [type:
+            (?x rdf:type ?a) -> (?x rdf:type ?b)]
+    ]
+    """
+
+
+def newCore(rules=''):
+    core = sempr.Core()
+    core.loadPlugins()
+    if rules:
+        core.addRules(rules)
+    return core
+
+
+def propertyMapEntities(n, properties=5):
+    entities = []
+    for i in range(n):
+        e = sempr.Entity()
+        pm = sempr.TriplePropertyMap()
+        for p in range(properties):
+            pm[f'ex:p{p}'] = i * p
+        pm[rdf.baseURI() + 'type'] = f'ex:Class{i % 10}', True
+        e.addComponent(pm)
+        entities.append((e, pm))
+    return entities
+
+
+def classChain(depth):
+    # ex:C0 subClassOf ex:C1 subClassOf ... ex:C<depth>
+    return [(f'<ex:C{i}>', rdfs.subClassOf(), f'<ex:C{i+1}>') for i in range(depth)]
+
+
+def addTriples(core, triples):
+    e = sempr.Entity()
+    tv = sempr.TripleVector(triples)
+    e.addComponent(tv)
+    core.addEntity(e)
+    return e, tv
+
+
+# --- benchmarks --------------------------------------------------------------
+# Each takes a size and returns a function that runs the measured part once.
+# Setup work is done outside of the returned function.
+
+def benchIngest(n):
+    core = newCore()
+    entities = [e for e, _ in propertyMapEntities(n)]
+    def run():
+        core.addEntities(entities)
+        core.performInference()
+    return run
+
+
+def benchTripleVectorUpdate(n):
+    core = newCore()
+    _, tv = addTriples(core, [])
+    core.performInference()
+    triples = [(f'<ex:s{i}>', '<ex:p>', f'<ex:o{i}>') for i in range(n)]
+    def run():
+        tv.clear()
+        tv.extend(triples)
+        tv.changed()
+        core.performInference()
+    return run
+
+
+def benchPropertyMapUpdate(n):
+    core = newCore()
+    entities = propertyMapEntities(n)
+    core.addEntities([e for e, _ in entities])
+    core.performInference()
+    counter = [0]
+    def run():
+        counter[0] += 1
+        for _, pm in entities:
+            pm['ex:p0'] = counter[0]
+            pm.changed()
+        core.performInference()
+    return run
+
+
+def benchTransitiveClosure(depth):
+    core = newCore(subclassRules())
+    triples = classChain(depth)
+    def run():
+        addTriples(core, triples)
+        core.performInference()
+    return run
+
+
+def benchSparql(n):
+    core = newCore()
+    addTriples(core, [(f'<ex:s{i}>', '<ex:p>', f'<ex:o{i % 100}>') for i in range(n)])
+    core.performInference()
+    query = 'SELECT ?s ?o WHERE { ?s <ex:p> ?o . }'
+    def run():
+        core.query(query)
+    return run
+
+
+def benchSparqlColumns(n):
+    core = newCore()
+    addTriples(core, [(f'<ex:s{i}>', '<ex:p>', f'<ex:o{i % 100}>') for i in range(n)])
+    core.performInference()
+    query = 'SELECT ?s ?o WHERE { ?s <ex:p> ?o . }'
+    def run():
+        core.queryColumns(query)
+    return run
+
+
+def benchCallback(n):
+    core = newCore()
+    calls = []
+    core.registerCallbackEffect(lambda flag, s: calls.append(s), 'cb')
+    core.addRules('[(?s <ex:p> ?o) -> cb(?s)]')
+    triples = [(f'<ex:s{i}>', '<ex:p>', '<ex:o>') for i in range(n)]
+    def run():
+        e, _ = addTriples(core, triples)
+        core.performInference()
+        core.removeEntity(e)
+        core.performInference()
+    return run
+
+
+def benchBatchedCallback(n):
+    core = newCore()
+    calls = []
+    core.registerBatchedCallbackEffect(lambda firings: calls.append(len(firings)), 'cb', 1)
+    core.addRules('[(?s <ex:p> ?o) -> cb(?s)]')
+    triples = [(f'<ex:s{i}>', '<ex:p>', '<ex:o>') for i in range(n)]
+    def run():
+        e, _ = addTriples(core, triples)
+        core.performInference()
+        core.removeEntity(e)
+        core.performInference()
+    return run
+
+
+def deepExplanation(depth):
+    core = newCore(subclassRules())
+    addTriples(core, classChain(depth) + [('<ex:x>', rdf.type(), '<ex:C0>')])
+    core.performInference()
+    return core, sempr.Triple('<ex:x>', rdf.type(), f'<ex:C{depth}>')
+
+
+def benchExplainJSON(depth):
+    core, toExplain = deepExplanation(depth)
+    def run():
+        # a new core run invalidates the cache, measure the traversal
+        core.performInference()
+        core.explainAsJSON(toExplain)
+    return run
+
+
+def benchExplanationGraph(depth):
+    core, toExplain = deepExplanation(depth)
+    def run():
+        core.explainMany([toExplain])
+    return run
+
+
+BENCHMARKS = {
+    'ingest':                 (benchIngest,             [1000, 10000]),
+    'tripleVectorUpdate':     (benchTripleVectorUpdate, [1000, 10000]),
+    'propertyMapUpdate':      (benchPropertyMapUpdate,  [100, 1000]),
+    'inference.transitive':   (benchTransitiveClosure,  [10, 30, 60]),
+    'sparql':                 (benchSparql,             [1000, 10000, 100000]),
+    'sparql.columns':         (benchSparqlColumns,      [1000, 10000, 100000]),
+    'callback':               (benchCallback,           [1000, 10000]),
+    'callback.batched':       (benchBatchedCallback,    [1000, 10000]),
+    'explain.json':           (benchExplainJSON,        [10, 30]),
+    'explain.graph':          (benchExplanationGraph,   [10, 30]),
+}
+
+
+# --- runner ------------------------------------------------------------------
+
+def measure(setup, size, repeat):
+    times = []
+    for _ in range(repeat):
+        run = setup(size)
+        start = time.perf_counter()
+        run()
+        times.append(time.perf_counter() - start)
+    return times
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--filter', default='', help='only run benchmarks whose name contains this')
+    parser.add_argument('--repeat', type=int, default=5, help='runs per benchmark and size')
+    parser.add_argument('--scale', type=float, default=1.0, help='factor for all sizes')
+    parser.add_argument('--output', help='write the results to this JSON file')
+    args = parser.parse_args()
+
+    results = []
+    for name, (setup, sizes) in BENCHMARKS.items():
+        if args.filter not in name:
+            continue
+
+        for size in sizes:
+            size = max(1, int(size * args.scale))
+            times = measure(setup, size, args.repeat)
+            results.append({
+                'name': name,
+                'size': size,
+                'seconds': times,
+                'min': min(times),
+                'median': statistics.median(times),
+            })
+            print(f'{name:24s} {size:8d}  min {min(times)*1000:10.3f} ms  '
+                  f'median {statistics.median(times)*1000:10.3f} ms')
+            sys.stdout.flush()
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump({
+                'python': platform.python_version(),
+                'platform': platform.platform(),
+                'repeat': args.repeat,
+                'scale': args.scale,
+                'results': results,
+            }, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -3,7 +3,7 @@ import os
 import sys
 import subprocess
 
-from setuptools import setup, Extension
+from setuptools import setup, Command, Extension
 from setuptools.command.build_ext import build_ext
 
 # Convert distutils Windows platform specifiers to CMake -A arguments
@@ -100,6 +100,30 @@ class CMakeBuild(build_ext):
         )
 
 
+# python setup.py bench [--args="--filter sparql --repeat 3"]
+class Bench(Command):
+    description = "build the extension and run the benchmarks in bench/"
+    user_options = [("args=", None, "arguments passed to bench/bench.py")]
+
+    def initialize_options(self):
+        self.args = ""
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        self.run_command("build_ext")
+        build_lib = self.get_finalized_command("build_ext").build_lib
+
+        env = dict(os.environ)
+        env["PYTHONPATH"] = os.pathsep.join(filter(None, [os.path.abspath(build_lib), env.get("PYTHONPATH")]))
+        subprocess.check_call(
+            [sys.executable, os.path.join("bench", "bench.py"), "--output", "bench_results.json"]
+            + self.args.split(),
+            env=env,
+        )
+
+
 # The information here can also be placed in setup.cfg - better separation of
 # logic and declaration, and simpler if you include description/version in a file.
 setup(
@@ -109,6 +133,6 @@ setup(
     description="Python bindings for sempr",
     long_description="",
     ext_modules=[CMakeExtension("src")],
-    cmdclass={"build_ext": CMakeBuild},
+    cmdclass={"build_ext": CMakeBuild, "bench": Bench},
     zip_safe=False,
 )
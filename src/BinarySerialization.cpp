@@ -0,0 +1,284 @@
+#include "BinarySerialization.hpp"
+#include "GeosConversion.hpp"
+
+#include <sempr/component/AffineTransform.hpp>
+#include <sempr/component/GeosGeometry.hpp>
+#include <sempr/component/TripleVector.hpp>
+#include <sempr/component/TriplePropertyMap.hpp>
+
+#include <cereal/archives/portable_binary.hpp>
+#include <cereal/types/string.hpp>
+
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <typeinfo>
+#include <vector>
+
+using namespace sempr;
+
+namespace {
+
+enum ComponentType : uint8_t {
+    BASE_COMPONENT = 0,
+    AFFINE_TRANSFORM = 1,
+    GEOS_GEOMETRY = 2,
+    TRIPLE_VECTOR = 3,
+    TRIPLE_PROPERTY_MAP = 4
+};
+
+ComponentType typeOf(const Component& component)
+{
+    const auto& type = typeid(component);
+    if (type == typeid(Component)) return BASE_COMPONENT;
+    if (type == typeid(AffineTransform)) return AFFINE_TRANSFORM;
+    if (type == typeid(GeosGeometry)) return GEOS_GEOMETRY;
+    if (type == typeid(TripleVector)) return TRIPLE_VECTOR;
+    if (type == typeid(TriplePropertyMap)) return TRIPLE_PROPERTY_MAP;
+
+    throw std::runtime_error(std::string("no binary serialization for component type ") + type.name());
+}
+
+Component::Ptr createComponent(ComponentType type)
+{
+    switch (type) {
+        case BASE_COMPONENT: return std::make_shared<Component>();
+        case AFFINE_TRANSFORM: return std::make_shared<AffineTransform>();
+        case GEOS_GEOMETRY: return std::make_shared<GeosGeometry>(
+                                geos::geom::GeometryFactory::getDefaultInstance()->createPoint());
+        case TRIPLE_VECTOR: return std::make_shared<TripleVector>();
+        case TRIPLE_PROPERTY_MAP: return std::make_shared<TriplePropertyMap>();
+    }
+
+    throw std::runtime_error("invalid component type in binary data");
+}
+
+
+void save(cereal::PortableBinaryOutputArchive& ar, const Component& component)
+{
+    const ComponentType type = typeOf(component);
+    ar(static_cast<uint8_t>(type));
+
+    switch (type) {
+        case BASE_COMPONENT:
+            break;
+        case AFFINE_TRANSFORM:
+        {
+            auto& t = static_cast<const AffineTransform&>(component);
+            Eigen::Matrix4d mat = t.transform().matrix();
+            for (int i = 0; i < 16; i++) ar(mat.data()[i]);
+            break;
+        }
+        case GEOS_GEOMETRY:
+        {
+            auto& geo = static_cast<const GeosGeometry&>(component);
+            ar(writeWKB(*geo.geometry()));
+            break;
+        }
+        case TRIPLE_VECTOR:
+        {
+            auto& tv = static_cast<const TripleVector&>(component);
+            std::vector<Triple> triples;
+            tv.getTriples(triples);
+
+            ar(static_cast<uint64_t>(triples.size()));
+            for (auto& t : triples)
+            {
+                ar(t.getField(Triple::Field::SUBJECT),
+                   t.getField(Triple::Field::PREDICATE),
+                   t.getField(Triple::Field::OBJECT));
+            }
+            break;
+        }
+        case TRIPLE_PROPERTY_MAP:
+        {
+            auto& m = static_cast<const TriplePropertyMap&>(component);
+            ar(static_cast<uint64_t>(m.map_.size()));
+            for (auto& entry : m.map_)
+            {
+                auto& value = entry.second;
+                ar(entry.first, static_cast<uint8_t>(value.type()));
+                switch (value.type()) {
+                    case TriplePropertyMapEntry::RESOURCE:
+                    case TriplePropertyMapEntry::STRING:
+                        ar(static_cast<std::string>(value));
+                        break;
+                    case TriplePropertyMapEntry::FLOAT:
+                        ar(static_cast<float>(value));
+                        break;
+                    case TriplePropertyMapEntry::INT:
+                        ar(static_cast<int32_t>(static_cast<int>(value)));
+                        break;
+                    case TriplePropertyMapEntry::INVALID:
+                        break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+
+void load(cereal::PortableBinaryInputArchive& ar, Component& component, ComponentType type)
+{
+    switch (type) {
+        case BASE_COMPONENT:
+            break;
+        case AFFINE_TRANSFORM:
+        {
+            Eigen::Matrix4d mat;
+            for (int i = 0; i < 16; i++) ar(mat.data()[i]);
+            static_cast<AffineTransform&>(component).setTransform(Eigen::Affine3d(mat));
+            break;
+        }
+        case GEOS_GEOMETRY:
+        {
+            std::string wkb;
+            ar(wkb);
+            static_cast<GeosGeometry&>(component).setGeometry(readWKB(wkb));
+            break;
+        }
+        case TRIPLE_VECTOR:
+        {
+            auto& tv = static_cast<TripleVector&>(component);
+            tv.clear();
+
+            uint64_t num;
+            ar(num);
+            std::string s, p, o;
+            for (uint64_t i = 0; i < num; i++)
+            {
+                ar(s, p, o);
+                tv.addTriple(Triple(s, p, o));
+            }
+            break;
+        }
+        case TRIPLE_PROPERTY_MAP:
+        {
+            auto& m = static_cast<TriplePropertyMap&>(component);
+            m.map_.clear();
+
+            uint64_t num;
+            ar(num);
+            for (uint64_t i = 0; i < num; i++)
+            {
+                std::string key;
+                uint8_t type;
+                ar(key, type);
+
+                switch (type) {
+                    case TriplePropertyMapEntry::RESOURCE:
+                    case TriplePropertyMapEntry::STRING:
+                    {
+                        std::string value;
+                        ar(value);
+                        m.map_[key] = { value, type == TriplePropertyMapEntry::RESOURCE };
+                        break;
+                    }
+                    case TriplePropertyMapEntry::FLOAT:
+                    {
+                        float value;
+                        ar(value);
+                        m.map_[key] = value;
+                        break;
+                    }
+                    case TriplePropertyMapEntry::INT:
+                    {
+                        int32_t value;
+                        ar(value);
+                        m.map_[key] = static_cast<int>(value);
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+} // anonymous namespace
+
+
+std::string componentToBytes(const Component& component)
+{
+    std::ostringstream os;
+    {
+        cereal::PortableBinaryOutputArchive ar(os);
+        save(ar, component);
+    }
+    return os.str();
+}
+
+
+void componentFromBytes(Component& component, const std::string& bytes)
+{
+    std::istringstream is(bytes);
+    cereal::PortableBinaryInputArchive ar(is);
+
+    uint8_t type;
+    ar(type);
+    if (type != typeOf(component))
+        throw std::invalid_argument("binary data is of a different component type");
+
+    load(ar, component, static_cast<ComponentType>(type));
+}
+
+
+Component::Ptr createComponentFromBytes(const std::string& bytes)
+{
+    std::istringstream is(bytes);
+    cereal::PortableBinaryInputArchive ar(is);
+
+    uint8_t type;
+    ar(type);
+    auto component = createComponent(static_cast<ComponentType>(type));
+    load(ar, *component, static_cast<ComponentType>(type));
+    return component;
+}
+
+
+std::string entityToBytes(Entity& entity)
+{
+    std::ostringstream os;
+    {
+        cereal::PortableBinaryOutputArchive ar(os);
+        ar(entity.id(), entity.idIsURI());
+
+        auto components = entity.getComponentsWithTag<Component>();
+        ar(static_cast<uint64_t>(components.size()));
+        for (auto& entry : components)
+        {
+            ar(entry.second);
+            save(ar, *entry.first);
+        }
+    }
+    return os.str();
+}
+
+
+void entityFromBytes(Entity& entity, const std::string& bytes)
+{
+    std::istringstream is(bytes);
+    cereal::PortableBinaryInputArchive ar(is);
+
+    std::string id;
+    bool idIsURI;
+    ar(id, idIsURI);
+    if (idIsURI) entity.setURI(id);
+    else         entity.setId(id);
+
+    uint64_t num;
+    ar(num);
+    for (uint64_t i = 0; i < num; i++)
+    {
+        std::string tag;
+        uint8_t type;
+        ar(tag, type);
+
+        auto component = createComponent(static_cast<ComponentType>(type));
+        load(ar, *component, static_cast<ComponentType>(type));
+        entity.addComponent(component, tag);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef SEMPRPY_BINARYSERIALIZATION_HPP_
+#define SEMPRPY_BINARYSERIALIZATION_HPP_
+
+#include <sempr/Entity.hpp>
+#include <sempr/Component.hpp>
+
+#include <string>
+
+
+/*
+    Binary (de)serialization of entities and components, based on cereal's
+    portable binary archive. sempr components only provide hooks for JSON
+    archives, hence every component type known to the bindings is written
+    in a compact native form: AffineTransforms as 16 doubles, GeosGeometries
+    as WKB, and TripleVectors and TriplePropertyMaps as plain lists of
+    strings and values. Other component types cannot be serialized this way.
+*/
+
+std::string componentToBytes(const sempr::Component& component);
+
+/**
+    Loads the data into the given component, which must be of the same type
+    as the serialized one.
+*/
+void componentFromBytes(sempr::Component& component, const std::string& bytes);
+
+/**
+    Creates a new component of the serialized type.
+*/
+sempr::Component::Ptr createComponentFromBytes(const std::string& bytes);
+
+
+std::string entityToBytes(sempr::Entity& entity);
+
+/**
+    Sets the id of the given entity and adds the serialized components to it.
+*/
+void entityFromBytes(sempr::Entity& entity, const std::string& bytes);
+
+
+#endif /* include guard: SEMPRPY_BINARYSERIALIZATION_HPP_ */
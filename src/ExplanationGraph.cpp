@@ -0,0 +1,174 @@
+#include "ExplanationGraph.hpp"
+
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <rete-core/Token.hpp>
+#include <rete-reasoner/RuleParser.hpp>
+
+#include <algorithm>
+#include <deque>
+
+using namespace rete;
+
+
+int32_t ExplanationGraph::label(const std::string& str)
+{
+    auto it = stringIds_.find(str);
+    if (it != stringIds_.end()) return it->second;
+
+    int32_t id = static_cast<int32_t>(strings_.size());
+    strings_.push_back(str);
+    stringIds_[str] = id;
+    return id;
+}
+
+
+int32_t ExplanationGraph::node(NodeKind kind, const std::string& str, size_t depth)
+{
+    int32_t id = static_cast<int32_t>(kinds_.size());
+    kinds_.push_back(kind);
+    labels_.push_back(label(str));
+    depths_.push_back(static_cast<int32_t>(depth));
+    expanded_.push_back(0);
+    return id;
+}
+
+
+void ExplanationGraph::edge(int32_t from, int32_t to, EdgeKind kind)
+{
+    if (!edgeSet_.insert({ from, to }).second) return;
+
+    edges_.push_back(from);
+    edges_.push_back(to);
+    edgeKinds_.push_back(kind);
+}
+
+
+int32_t ExplanationGraph::wmeNode(WME::Ptr wme, size_t depth)
+{
+    auto it = wmeNodes_.find(wme);
+    if (it != wmeNodes_.end())
+    {
+        auto& d = depths_[it->second];
+        d = std::min(d, static_cast<int32_t>(depth));
+        return it->second;
+    }
+
+    int32_t id = node(WME_NODE, wme->toString(), depth);
+    wmeNodes_[wme] = id;
+    return id;
+}
+
+
+int32_t ExplanationGraph::evidenceNode(Evidence::Ptr evidence, size_t depth)
+{
+    auto it = evidenceNodes_.find(evidence);
+    if (it != evidenceNodes_.end())
+    {
+        auto& d = depths_[it->second];
+        d = std::min(d, static_cast<int32_t>(depth));
+        return it->second;
+    }
+
+    int32_t id;
+    auto inferred = std::dynamic_pointer_cast<InferredEvidence>(evidence);
+    if (inferred)
+    {
+        auto production = inferred->production();
+        auto name = (production ? production->getName() : "");
+        id = node(INFERRED_EVIDENCE, name.empty() ? evidence->toString() : name, depth);
+    }
+    else
+    {
+        id = node(ASSERTED_EVIDENCE, evidence->toString(), depth);
+    }
+
+    evidenceNodes_[evidence] = id;
+    return id;
+}
+
+
+int32_t ExplanationGraph::find(WME::Ptr wme) const
+{
+    auto it = wmeNodes_.find(wme);
+    return it == wmeNodes_.end() ? -1 : it->second;
+}
+
+
+int32_t ExplanationGraph::add(const InferenceState& state, WME::Ptr wme, size_t maxDepth)
+{
+    struct Item {
+        WME::Ptr wme;
+        int32_t node;
+        size_t depth;
+    };
+
+    // breadth first, so that every wme is expanded from its shortest path
+    const int32_t root = wmeNode(wme, 0);
+    std::deque<Item> queue{ Item{ wme, root, 0 } };
+
+    auto addMatched = [&](Token::Ptr token, int32_t from, EdgeKind kind, size_t depth)
+    {
+        for (; token; token = token->parent)
+        {
+            if (!token->wme) continue;
+            auto to = wmeNode(token->wme, depth);
+            edge(from, to, kind);
+            queue.push_back(Item{ token->wme, to, depth });
+        }
+    };
+
+    while (!queue.empty())
+    {
+        Item item = queue.front();
+        queue.pop_front();
+
+        if (item.depth >= maxDepth) continue;
+        const size_t remaining = maxDepth - item.depth;
+        if (expanded_[item.node] >= remaining) continue;
+        expanded_[item.node] = remaining;
+
+        auto group = std::dynamic_pointer_cast<TokenGroup>(item.wme);
+        if (group)
+        {
+            for (auto& token : group->token_)
+            {
+                addMatched(token, item.node, GROUPS, item.depth + 1);
+            }
+            continue;
+        }
+
+        auto explanation = state.explain(item.wme);
+        for (auto& evidence : explanation.evidences_)
+        {
+            auto ev = evidenceNode(evidence, item.depth);
+            edge(item.node, ev, SUPPORTED_BY);
+
+            auto inferred = std::dynamic_pointer_cast<InferredEvidence>(evidence);
+            if (inferred)
+            {
+                addMatched(inferred->token(), ev, USES, item.depth + 1);
+            }
+        }
+    }
+
+    return root;
+}
+
+
+py::dict ExplanationGraph::toPython() const
+{
+    const size_t numEdges = edgeKinds_.size();
+
+    py::dict graph;
+    graph["kind"] = py::array_t<uint8_t>(kinds_.size(), kinds_.data());
+    graph["label"] = py::array_t<int32_t>(labels_.size(), labels_.data());
+    graph["depth"] = py::array_t<int32_t>(depths_.size(), depths_.data());
+    graph["edges"] = py::array_t<int32_t>(std::vector<size_t>{ numEdges, 2 }, edges_.data());
+    graph["edgeKind"] = py::array_t<uint8_t>(numEdges, edgeKinds_.data());
+    graph["strings"] = strings_;
+    graph["nodeKinds"] = std::vector<std::string>{ "wme", "asserted", "inferred" };
+    graph["edgeKinds"] = std::vector<std::string>{ "supportedBy", "uses", "groups" };
+    return graph;
+}
@@ -0,0 +1,100 @@
+#ifndef SEMPRPY_EXPLANATIONGRAPH_HPP_
+#define SEMPRPY_EXPLANATIONGRAPH_HPP_
+
+#include <pybind11/pybind11.h>
+
+#include <rete-core/WME.hpp>
+#include <rete-reasoner/Reasoner.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+namespace py = pybind11;
+
+
+/** Orders WMEs by value, e.g. to look up a newly created Triple. */
+struct WMEPtrLess {
+    bool operator()(const rete::WME::Ptr& a, const rete::WME::Ptr& b) const { return *a < *b; }
+};
+
+
+/**
+    The explanation of one or more WMEs as a flat graph. Nodes are WMEs and
+    evidences; edges lead from a WME to the evidences that support it, from
+    an inferred evidence to the WMEs its rule matched, and from a TokenGroup
+    to the WMEs it groups. Shared parts of the explanations are contained
+    only once.
+
+    Built natively by walking InferenceState::explain, without visitors, and
+    handed to python as numpy arrays and a table of node labels.
+*/
+class ExplanationGraph {
+public:
+    enum NodeKind : uint8_t {
+        WME_NODE = 0,
+        ASSERTED_EVIDENCE = 1,
+        INFERRED_EVIDENCE = 2
+    };
+
+    enum EdgeKind : uint8_t {
+        SUPPORTED_BY = 0, // wme -> evidence
+        USES = 1,         // inferred evidence -> wme
+        GROUPS = 2        // token group -> wme
+    };
+
+    /**
+        Adds the explanation of the given WME, expanded up to maxDepth WMEs
+        deep (the WME itself has depth 0). Returns the node of the WME.
+        Needs the sempr mutex.
+    */
+    int32_t add(const rete::InferenceState& state, rete::WME::Ptr wme,
+                size_t maxDepth = std::numeric_limits<size_t>::max());
+
+    size_t numNodes() const { return kinds_.size(); }
+    size_t numEdges() const { return edgeKinds_.size(); }
+
+    /**
+        Converts the graph to a dict of numpy arrays:
+        kind (N), label (N, index into strings), depth (N), edges (E, 2),
+        edgeKind (E), strings, and the names of nodeKinds and edgeKinds.
+        Needs the GIL.
+    */
+    py::dict toPython() const;
+
+    /** Node of the given wme, or -1 if it is not part of the graph. */
+    int32_t find(rete::WME::Ptr wme) const;
+
+private:
+    std::map<rete::WME::Ptr, int32_t, WMEPtrLess> wmeNodes_;
+    std::map<rete::Evidence::Ptr, int32_t> evidenceNodes_;
+    // number of levels below a wme node that have been expanded, to expand
+    // it further when it is reached on a shorter path or with a larger
+    // maxDepth
+    std::vector<size_t> expanded_;
+    std::set<std::pair<int32_t, int32_t>> edgeSet_;
+
+    std::vector<uint8_t> kinds_;
+    std::vector<int32_t> labels_;
+    std::vector<int32_t> depths_;
+    std::vector<int32_t> edges_; // pairs
+    std::vector<uint8_t> edgeKinds_;
+
+    std::vector<std::string> strings_;
+    std::unordered_map<std::string, int32_t> stringIds_;
+
+    int32_t label(const std::string& str);
+    int32_t node(NodeKind kind, const std::string& label, size_t depth);
+    void edge(int32_t from, int32_t to, EdgeKind kind);
+
+    int32_t wmeNode(rete::WME::Ptr wme, size_t depth);
+    int32_t evidenceNode(rete::Evidence::Ptr evidence, size_t depth);
+};
+
+
+#endif /* include guard: SEMPRPY_EXPLANATIONGRAPH_HPP_ */
@@ -0,0 +1,150 @@
+#ifndef SEMPRPY_GEOSCONVERSION_HPP_
+#define SEMPRPY_GEOSCONVERSION_HPP_
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+#include <geos/constants.h>
+#include <geos/geom/Coordinate.h>
+#include <geos/geom/CoordinateSequence.h>
+#include <geos/geom/CoordinateSequenceFactory.h>
+#include <geos/geom/Geometry.h>
+#include <geos/geom/GeometryFactory.h>
+#include <geos/geom/LinearRing.h>
+#include <geos/geom/LineString.h>
+#include <geos/geom/MultiPoint.h>
+#include <geos/geom/Point.h>
+#include <geos/geom/Polygon.h>
+#include <geos/io/WKBReader.h>
+#include <geos/io/WKBWriter.h>
+#include <geos/io/WKTReader.h>
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace py = pybind11;
+
+// Conversions of geos geometries from and to WKT, WKB and numpy arrays.
+// The results of the geos factories and readers are wrapped in unique_ptrs
+// directly, as they return raw pointers in older geos versions.
+
+inline std::unique_ptr<geos::geom::Geometry> readWKT(const std::string& wkt)
+{
+    auto& factory = *geos::geom::GeometryFactory::getDefaultInstance();
+    geos::io::WKTReader reader(factory);
+
+    std::unique_ptr<geos::geom::Geometry> g(reader.read(wkt));
+    return g;
+}
+
+
+inline std::unique_ptr<geos::geom::Geometry> readWKB(const std::string& wkb)
+{
+    auto& factory = *geos::geom::GeometryFactory::getDefaultInstance();
+    geos::io::WKBReader reader(factory);
+
+    std::istringstream is(wkb);
+    std::unique_ptr<geos::geom::Geometry> g(reader.read(is));
+    return g;
+}
+
+
+inline std::string writeWKB(const geos::geom::Geometry& geometry)
+{
+    geos::io::WKBWriter writer;
+    writer.setOutputDimension(geometry.getCoordinateDimension());
+
+    std::ostringstream os;
+    writer.write(geometry, os);
+    return os.str();
+}
+
+
+/**
+    Copies the coordinates of the geometry into a (N, 2) or (N, 3) array,
+    depending on its coordinate dimension.
+*/
+inline py::array_t<double> toCoordinateArray(const geos::geom::Geometry& geometry)
+{
+    std::unique_ptr<geos::geom::CoordinateSequence> seq(geometry.getCoordinates());
+
+    const size_t num = seq->getSize();
+    const size_t dim = (geometry.getCoordinateDimension() == 3 ? 3 : 2);
+
+    py::array_t<double> coords(std::vector<size_t>{ num, dim });
+    auto c = coords.mutable_unchecked<2>();
+    for (size_t i = 0; i < num; i++)
+    {
+        auto& coord = seq->getAt(i);
+        c(i, 0) = coord.x;
+        c(i, 1) = coord.y;
+        if (dim == 3) c(i, 2) = coord.z;
+    }
+
+    return coords;
+}
+
+
+/**
+    Creates a Point, LineString, LinearRing, Polygon (without holes) or
+    MultiPoint from a (N, 2) or (N, 3) array of coordinates.
+*/
+inline std::unique_ptr<geos::geom::Geometry> fromCoordinateArray(
+        py::array_t<double, py::array::c_style | py::array::forcecast> coords,
+        const std::string& type)
+{
+    if (coords.ndim() != 2 || (coords.shape(1) != 2 && coords.shape(1) != 3))
+        throw std::invalid_argument("coordinates must be of shape (N, 2) or (N, 3)");
+
+    const size_t num = coords.shape(0);
+    const size_t dim = coords.shape(1);
+    auto c = coords.unchecked<2>();
+
+    std::vector<geos::geom::Coordinate> points;
+    points.reserve(num);
+    for (size_t i = 0; i < num; i++)
+    {
+        points.emplace_back(c(i, 0), c(i, 1), dim == 3 ? c(i, 2) : geos::DoubleNotANumber);
+    }
+
+    auto factory = geos::geom::GeometryFactory::getDefaultInstance();
+    std::unique_ptr<geos::geom::CoordinateSequence> seq(
+        factory->getCoordinateSequenceFactory()->create(std::move(points), dim)
+    );
+
+    std::unique_ptr<geos::geom::Geometry> geometry;
+    if (type == "Point")
+    {
+        if (num != 1) throw std::invalid_argument("a Point needs exactly one coordinate");
+        geometry = std::unique_ptr<geos::geom::Geometry>(factory->createPoint(seq->getAt(0)));
+    }
+    else if (type == "LineString")
+    {
+        geometry = std::unique_ptr<geos::geom::Geometry>(factory->createLineString(*seq));
+    }
+    else if (type == "LinearRing")
+    {
+        geometry = std::unique_ptr<geos::geom::Geometry>(factory->createLinearRing(*seq));
+    }
+    else if (type == "Polygon")
+    {
+        std::unique_ptr<geos::geom::LinearRing> shell(factory->createLinearRing(*seq));
+        geometry = std::unique_ptr<geos::geom::Geometry>(factory->createPolygon(*shell, {}));
+    }
+    else if (type == "MultiPoint")
+    {
+        geometry = std::unique_ptr<geos::geom::Geometry>(factory->createMultiPoint(*seq));
+    }
+    else
+    {
+        throw std::invalid_argument("unsupported geometry type: " + type);
+    }
+
+    return geometry;
+}
+
+
+#endif /* include guard: SEMPRPY_GEOSCONVERSION_HPP_ */
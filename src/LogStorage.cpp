@@ -0,0 +1,341 @@
+#include "LogStorage.hpp"
+#include "BinarySerialization.hpp"
+#include "Tracer.hpp"
+
+#include <sempr/SeparateFileStorage.hpp> // fs
+
+#include <cstdio>
+#include <iterator>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace sempr;
+
+/*
+    File layout: the magic string, followed by records of
+        op (1 byte), id size (8 bytes), id, data size (8 bytes), data
+    with sizes in little endian. op is either PUT (data: the entity) or
+    DELETE (no data). A truncated last record, e.g. after a crash, is
+    dropped and overwritten by the next append, as is a tail of zero bytes;
+    a file that is shorter than the magic string is treated as empty. Any
+    other invalid record is an error, so that no valid record after it is
+    lost.
+*/
+
+namespace {
+
+const std::string MAGIC = "SEMPRLOG1";
+
+enum Op : uint8_t {
+    PUT = 1,
+    DELETE = 2
+};
+
+void writeSize(std::ostream& os, uint64_t size)
+{
+    char bytes[8];
+    for (int i = 0; i < 8; i++) bytes[i] = static_cast<char>((size >> (8*i)) & 0xff);
+    os.write(bytes, 8);
+}
+
+bool readSize(const std::string& buffer, size_t& pos, uint64_t& size)
+{
+    if (buffer.size() - pos < 8) return false;
+    size = 0;
+    for (int i = 0; i < 8; i++) size |= uint64_t(static_cast<unsigned char>(buffer[pos+i])) << (8*i);
+    pos += 8;
+    return true;
+}
+
+uint64_t headerSize(const std::string& id)
+{
+    return 1 + 8 + id.size() + 8;
+}
+
+// flushes a file or directory to the disk
+void syncPath(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open " + path);
+    int result = ::fsync(fd);
+    ::close(fd);
+    if (result != 0) throw std::runtime_error("failed to sync " + path);
+}
+
+} // anonymous namespace
+
+
+LogStorage::LogStorage(const std::string& path)
+    : path_(path)
+{
+    {
+        // create the file if it does not exist yet
+        std::ofstream create(path_, std::ios::binary | std::ios::app);
+        if (!create) throw std::runtime_error("cannot open " + path_);
+    }
+    scan();
+    open();
+}
+
+
+void LogStorage::open()
+{
+    file_.close();
+
+    // drop a truncated last record
+    if (fs::file_size(path_) > fileSize_) fs::resize_file(path_, fileSize_);
+
+    file_.open(path_, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file_) throw std::runtime_error("cannot open " + path_);
+
+    if (fileSize_ == 0)
+    {
+        file_.write(MAGIC.data(), MAGIC.size());
+        fileSize_ = MAGIC.size();
+    }
+    file_.seekp(fileSize_);
+}
+
+
+void LogStorage::scan()
+{
+    // one sequential read of the whole file
+    std::string buffer;
+    {
+        std::ifstream in(path_, std::ios::binary);
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    index_.clear();
+    fileSize_ = 0;
+    liveSize_ = 0;
+    if (buffer.size() < MAGIC.size())
+    {
+        // empty, or the very first write was torn: start over
+        if (MAGIC.compare(0, buffer.size(), buffer) == 0) return;
+        throw std::runtime_error(path_ + " is not a sempr log file");
+    }
+
+    if (buffer.compare(0, MAGIC.size(), MAGIC) != 0)
+        throw std::runtime_error(path_ + " is not a sempr log file");
+
+    size_t pos = MAGIC.size();
+    fileSize_ = pos;
+    while (pos < buffer.size())
+    {
+        // the record must be complete and valid before it touches the index,
+        // only an incomplete record at the end is dropped
+        const size_t start = pos;
+        uint8_t op = static_cast<uint8_t>(buffer[pos++]);
+        if (op != PUT && op != DELETE)
+        {
+            // some file systems leave zeros after a crash during an append
+            if (buffer.find_first_not_of('\0', start) == std::string::npos) break;
+            throw std::runtime_error(path_ + " is corrupt at offset " + std::to_string(start));
+        }
+
+        uint64_t idSize, dataSize;
+        if (!readSize(buffer, pos, idSize) || buffer.size() - pos < idSize) break;
+        std::string id = buffer.substr(pos, idSize);
+        pos += idSize;
+        if (!readSize(buffer, pos, dataSize) || buffer.size() - pos < dataSize) break;
+
+        auto it = index_.find(id);
+        if (it != index_.end())
+        {
+            liveSize_ -= headerSize(id) + it->second.size;
+            index_.erase(it);
+        }
+
+        if (op == PUT)
+        {
+            index_[id] = Record{ pos, dataSize };
+            liveSize_ += headerSize(id) + dataSize;
+        }
+
+        pos += dataSize;
+        fileSize_ = pos;
+    }
+}
+
+
+std::vector<Entity::Ptr> LogStorage::loadAll() const
+{
+    std::ifstream in(path_, std::ios::binary);
+
+    std::vector<Entity::Ptr> entities;
+    entities.reserve(index_.size());
+    for (auto& entry : index_)
+    {
+        std::string data(entry.second.size, '\0');
+        in.seekg(entry.second.offset);
+        in.read(&data[0], data.size());
+
+        auto entity = Entity::create();
+        entityFromBytes(*entity, data);
+        entities.push_back(entity);
+    }
+
+    return entities;
+}
+
+
+void LogStorage::append(uint8_t op, const std::string& id, const std::string& data)
+{
+    const uint64_t offset = fileSize_ + headerSize(id);
+
+    file_.put(static_cast<char>(op));
+    writeSize(file_, id.size());
+    file_.write(id.data(), id.size());
+    writeSize(file_, data.size());
+    file_.write(data.data(), data.size());
+    if (!file_) recover("failed to write to " + path_);
+
+    auto it = index_.find(id);
+    if (it != index_.end())
+    {
+        liveSize_ -= headerSize(id) + it->second.size;
+        index_.erase(it);
+    }
+
+    if (op == PUT)
+    {
+        index_[id] = Record{ offset, data.size() };
+        liveSize_ += headerSize(id) + data.size();
+    }
+
+    fileSize_ = offset + data.size();
+}
+
+
+void LogStorage::save(std::vector<Entity::Ptr>& entities)
+{
+    for (auto& entity : entities)
+    {
+        append(PUT, entity->id(), entityToBytes(*entity));
+    }
+    file_.flush();
+    if (!file_) recover("failed to write to " + path_);
+    maybeCompact();
+}
+
+
+void LogStorage::remove(std::vector<Entity::Ptr>& entities)
+{
+    for (auto& entity : entities)
+    {
+        if (index_.count(entity->id())) append(DELETE, entity->id(), "");
+    }
+    file_.flush();
+    if (!file_) recover("failed to write to " + path_);
+    maybeCompact();
+}
+
+
+void LogStorage::save(Entity::Ptr entity)
+{
+    std::vector<Entity::Ptr> entities{ entity };
+    save(entities);
+}
+
+
+void LogStorage::remove(Entity::Ptr entity)
+{
+    std::vector<Entity::Ptr> entities{ entity };
+    remove(entities);
+}
+
+
+std::string LogStorage::createIDFor(Entity::Ptr)
+{
+    std::string id;
+    do {
+        id = "Entity_" + std::to_string(nextId_++);
+    } while (index_.count(id) || reservedIds_.count(id));
+
+    reservedIds_.insert(id);
+    return id;
+}
+
+
+void LogStorage::releaseIDOf(Entity::Ptr entity)
+{
+    reservedIds_.erase(entity->id());
+}
+
+
+void LogStorage::recover(const std::string& error)
+{
+    // the index and size may count records that did not reach the file, and
+    // the file may end with a partial record: re-read what is on the disk
+    try
+    {
+        file_.close();
+        file_.clear();
+        scan();
+        open();
+    }
+    catch (std::exception&)
+    {
+        // leave file_ closed, so that later writes fail, too
+    }
+    throw std::runtime_error(error);
+}
+
+
+void LogStorage::maybeCompact()
+{
+    if (fileSize_ > minCompactionSize && fileSize_ > 2 * liveSize_) compact();
+}
+
+
+void LogStorage::compact()
+{
+    TraceSpan span("persistence", "compact log");
+    file_.flush();
+
+    const std::string tmpPath = path_ + ".compact";
+    {
+        std::ifstream in(path_, std::ios::binary);
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        out.write(MAGIC.data(), MAGIC.size());
+
+        std::string data;
+        for (auto& entry : index_)
+        {
+            data.resize(entry.second.size);
+            in.seekg(entry.second.offset);
+            in.read(&data[0], data.size());
+
+            out.put(static_cast<char>(PUT));
+            writeSize(out, entry.first.size());
+            out.write(entry.first.data(), entry.first.size());
+            writeSize(out, data.size());
+            out.write(data.data(), data.size());
+        }
+
+        out.flush();
+        if (!in || !out) throw std::runtime_error("failed to compact " + path_);
+    }
+
+    // the new file must be on the disk before it replaces the old one, and
+    // the rename before the old records are forgotten
+    syncPath(tmpPath);
+
+    file_.close();
+    if (std::rename(tmpPath.c_str(), path_.c_str()) != 0)
+    {
+        // keep appending to the old file
+        std::remove(tmpPath.c_str());
+        open();
+        throw std::runtime_error("failed to replace " + path_);
+    }
+
+    auto dir = fs::path(path_).parent_path().string();
+    syncPath(dir.empty() ? "." : dir);
+
+    scan();
+    open();
+}
@@ -0,0 +1,74 @@
+#ifndef SEMPRPY_LOGSTORAGE_HPP_
+#define SEMPRPY_LOGSTORAGE_HPP_
+
+#include <sempr/DBConnection.hpp>
+#include <sempr/IDGenerator.hpp>
+#include <sempr/Entity.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+/**
+    Persistence in a single append-only file. Every save appends the binary
+    serialization of the entity (see BinarySerialization.hpp), every removal
+    a tombstone. An index of the latest record per entity id is kept in
+    memory; it is rebuilt on startup by reading the file sequentially.
+    Superseded records are dropped by compaction, which rewrites the live
+    records to a new file and replaces the old one. It is done automatically
+    when more than half of a file larger than minCompactionSize is garbage.
+
+    Also acts as the id generator, as it knows every id in use.
+*/
+class LogStorage : public sempr::DBConnection, public sempr::IDGenerator {
+public:
+    using Ptr = std::shared_ptr<LogStorage>;
+
+    LogStorage(const std::string& path);
+
+    std::vector<sempr::Entity::Ptr> loadAll() const override;
+    void save(std::vector<sempr::Entity::Ptr>& entities) override;
+    void remove(std::vector<sempr::Entity::Ptr>& entities) override;
+    void save(sempr::Entity::Ptr entity) override;
+    void remove(sempr::Entity::Ptr entity) override;
+
+    std::string createIDFor(sempr::Entity::Ptr entity) override;
+    void releaseIDOf(sempr::Entity::Ptr entity) override;
+
+    /** Rewrites the file with only the latest record of each entity. */
+    void compact();
+
+    /** Size of the file and of the records that are still in use, in bytes. */
+    uint64_t fileSize() const { return fileSize_; }
+    uint64_t liveSize() const { return liveSize_; }
+
+    static const uint64_t minCompactionSize = 1 << 20;
+
+private:
+    struct Record {
+        uint64_t offset; // of the data
+        uint64_t size;
+    };
+
+    std::string path_;
+    std::fstream file_;
+    std::unordered_map<std::string, Record> index_;
+    std::unordered_set<std::string> reservedIds_;
+    uint64_t fileSize_ = 0;
+    uint64_t liveSize_ = 0;
+    uint64_t nextId_ = 0;
+
+    void open();
+    void scan();
+    void append(uint8_t op, const std::string& id, const std::string& data);
+    /** Re-reads the file after a failed write and throws the error. */
+    [[noreturn]] void recover(const std::string& error);
+    void maybeCompact();
+};
+
+
+#endif /* include guard: SEMPRPY_LOGSTORAGE_HPP_ */
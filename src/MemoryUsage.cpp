@@ -0,0 +1,198 @@
+#include "MemoryUsage.hpp"
+#include "PyCore.hpp"
+#include "NetworkStats.hpp"
+#include "BinarySerialization.hpp"
+
+#include <sempr/ECWME.hpp>
+#include <sempr/component/AffineTransform.hpp>
+#include <sempr/component/GeosGeometry.hpp>
+#include <sempr/component/TripleVector.hpp>
+#include <sempr/component/TriplePropertyMap.hpp>
+#include <sempr/plugins/RDFPlugin.hpp>
+
+#include <rete-core/Token.hpp>
+#include <rete-rdf/Triple.hpp>
+#include <rete-reasoner/RuleParser.hpp>
+
+#include <cctype>
+#include <set>
+#include <typeinfo>
+#include <unordered_set>
+
+using namespace sempr;
+
+namespace {
+
+// bookkeeping per entry of the std::maps/sets in the inference state
+const size_t nodeOverhead = 4 * sizeof(void*);
+
+size_t stringBytes(const std::string& str)
+{
+    return sizeof(std::string) + (str.capacity() > 15 ? str.capacity() + 1 : 0);
+}
+
+std::string componentTypeName(const Component& component)
+{
+    auto& type = typeid(component);
+    if (type == typeid(TripleVector)) return "TripleVector";
+    if (type == typeid(TriplePropertyMap)) return "TriplePropertyMap";
+    if (type == typeid(GeosGeometry)) return "GeosGeometry";
+    if (type == typeid(AffineTransform)) return "AffineTransform";
+    if (type == typeid(Component)) return "Component";
+    return type.name();
+}
+
+long countRDFTriples(PyCore& core)
+{
+    auto rdf = core.getPlugin<RDFPlugin>();
+    if (!rdf) return -1;
+
+    try
+    {
+        SPARQLQuery query;
+        query.query = "SELECT (COUNT(*) AS ?n) WHERE { ?s ?p ?o . }";
+        rdf->soprano().answer(query);
+        if (query.results.empty()) return 0;
+
+        // a plain or a typed literal: 42 or "42"^^<...#integer>
+        const std::string& value = query.results[0].at("n").second;
+        const bool quoted = !value.empty() && value[0] == '"';
+        size_t begin = quoted ? 1 : 0, end = begin;
+        while (end < value.size() && std::isdigit(static_cast<unsigned char>(value[end]))) end++;
+
+        if (end == begin) return -1;
+        if (quoted ? (end == value.size() || value[end] != '"') : end != value.size()) return -1;
+        return std::stol(value.substr(begin, end - begin));
+    }
+    catch (std::exception&)
+    {
+        return -1;
+    }
+}
+
+} // anonymous namespace
+
+
+MemoryUsage MemoryUsage::of(PyCore& core)
+{
+    MemoryUsage usage;
+    auto& state = core.reasoner().getCurrentState();
+
+    std::set<const Component*> seenComponents;
+    for (auto& wme : state.getWMEs())
+    {
+        std::string type;
+        size_t bytes = nodeOverhead;
+
+        if (auto triple = std::dynamic_pointer_cast<rete::Triple>(wme))
+        {
+            type = "Triple";
+            bytes += sizeof(rete::Triple) + stringBytes(triple->subject) +
+                     stringBytes(triple->predicate) + stringBytes(triple->object) -
+                     3 * sizeof(std::string);
+        }
+        else if (auto ec = std::dynamic_pointer_cast<ECWME>(wme))
+        {
+            type = "ECWME";
+            bytes += sizeof(ECWME) + stringBytes(std::get<2>(ec->value_)) - sizeof(std::string);
+
+            auto component = std::get<1>(ec->value_);
+            if (component && seenComponents.insert(component.get()).second)
+            {
+                auto& byType = usage.componentsByType[componentTypeName(*component)];
+                size_t size = 0;
+                try { size = componentToBytes(*component).size(); } catch (std::exception&) {}
+
+                byType.count++;
+                byType.bytes += size;
+                usage.components.count++;
+                usage.components.bytes += size;
+            }
+        }
+        else if (auto group = std::dynamic_pointer_cast<rete::TokenGroup>(wme))
+        {
+            type = "TokenGroup";
+            bytes += sizeof(rete::TokenGroup) + group->token_.size() * sizeof(rete::Token::Ptr);
+        }
+        else
+        {
+            type = "other";
+            bytes += sizeof(rete::WME);
+        }
+
+        auto& byType = usage.wmesByType[type];
+        byType.count++;
+        byType.bytes += bytes;
+        usage.wmes.count++;
+        usage.wmes.bytes += bytes;
+    }
+
+    auto stats = NetworkStats::of(state);
+    usage.evidences.count = state.numEvidences();
+    usage.evidences.bytes = usage.evidences.count * (nodeOverhead + 2 * sizeof(rete::Evidence::Ptr));
+    for (auto& entry : stats.productions)
+    {
+        auto& rule = usage.tokensByRule[entry.first];
+        rule.count = entry.second.tokens;
+        rule.bytes = entry.second.bytes;
+    }
+
+    // rules may share the parent tokens of their matches, count each once
+    std::unordered_set<const rete::Token*> tokens;
+    for (auto& wme : state.getWMEs())
+    {
+        for (auto& evidence : state.explain(wme).evidences_)
+        {
+            auto inferred = std::dynamic_pointer_cast<rete::InferredEvidence>(evidence);
+            if (!inferred) continue;
+
+            // stop at the first token already seen, its parents are, too
+            auto token = inferred->token();
+            while (token && tokens.insert(token.get()).second) token = token->parent;
+        }
+    }
+    usage.tokens.count = tokens.size();
+    usage.tokens.bytes = tokens.size() * sizeof(rete::Token);
+
+    usage.rdfTriples = countRDFTriples(core);
+    usage.spatialIndexEntries = core.spatialIndexSize();
+    usage.explanationCacheEntries = core.explanationCacheSize();
+
+    return usage;
+}
+
+
+py::dict MemoryUsage::toPython() const
+{
+    auto entry = [](const Entry& e)
+    {
+        py::dict d;
+        d["count"] = e.count;
+        d["bytes"] = e.bytes;
+        return d;
+    };
+    auto entries = [&](const std::map<std::string, Entry>& m)
+    {
+        py::dict d;
+        for (auto& e : m) d[py::str(e.first)] = entry(e.second);
+        return d;
+    };
+
+    py::dict wmesDict = entry(wmes);
+    wmesDict["byType"] = entries(wmesByType);
+    py::dict tokensDict = entry(tokens);
+    tokensDict["byRule"] = entries(tokensByRule);
+    py::dict componentsDict = entry(components);
+    componentsDict["byType"] = entries(componentsByType);
+
+    py::dict usage;
+    usage["wmes"] = wmesDict;
+    usage["evidences"] = entry(evidences);
+    usage["tokens"] = tokensDict;
+    usage["components"] = componentsDict;
+    usage["rdfStore"] = (rdfTriples < 0 ? py::object(py::none()) : py::object(py::int_(rdfTriples)));
+    usage["spatialIndexEntries"] = spatialIndexEntries;
+    usage["explanationCacheEntries"] = explanationCacheEntries;
+    usage["totalBytes"] = wmes.bytes + evidences.bytes + tokens.bytes + components.bytes;
+    return usage;
+}
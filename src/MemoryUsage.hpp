@@ -0,0 +1,52 @@
+#ifndef SEMPRPY_MEMORYUSAGE_HPP_
+#define SEMPRPY_MEMORYUSAGE_HPP_
+
+#include <pybind11/pybind11.h>
+
+#include <map>
+#include <string>
+
+namespace py = pybind11;
+
+class PyCore;
+
+
+/**
+    Estimated memory usage of a core, per subsystem. The numbers are
+    computed from the sizes of the objects and the strings they hold, not
+    measured at the allocator, so they are lower bounds that are meant to
+    show trends and relations rather than exact figures.
+
+    Tokens are only those reachable from the evidences of inferred WMEs,
+    i.e. the matches that currently produce something, each counted once
+    even if shared by several rules. Partial matches held in the beta
+    memories of the network are not counted. tokensByRule counts the tokens
+    reachable from the evidences of each rule, so shared tokens appear in
+    several rules.
+*/
+struct MemoryUsage {
+    struct Entry {
+        size_t count = 0;
+        size_t bytes = 0;
+    };
+
+    Entry wmes;
+    std::map<std::string, Entry> wmesByType;
+    Entry evidences;
+    Entry tokens;
+    std::map<std::string, Entry> tokensByRule;
+    Entry components; // bytes: size of their binary serialization
+    std::map<std::string, Entry> componentsByType;
+    long rdfTriples = -1; // -1: RDFPlugin not loaded or count not supported
+    size_t spatialIndexEntries = 0;
+    size_t explanationCacheEntries = 0;
+
+    /** Needs the sempr mutex. */
+    static MemoryUsage of(PyCore& core);
+
+    /** Needs the GIL. */
+    py::dict toPython() const;
+};
+
+
+#endif /* include guard: SEMPRPY_MEMORYUSAGE_HPP_ */
@@ -0,0 +1,178 @@
+#include "NetworkStats.hpp"
+
+#include <rete-core/Token.hpp>
+#include <rete-reasoner/RuleParser.hpp>
+
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace rete;
+
+
+std::string NetworkStats::nameOf(const Production::Ptr& production)
+{
+    if (!production) return "<unknown>";
+    auto name = production->getName();
+    return name.empty() ? production->toString() : name;
+}
+
+
+std::map<std::string, size_t> NetworkStats::countEvidences(const InferenceState& state)
+{
+    std::set<Evidence::Ptr> seen;
+    std::map<std::string, size_t> counts;
+
+    for (auto& wme : state.getWMEs())
+    {
+        for (auto& evidence : state.explain(wme).evidences_)
+        {
+            auto inferred = std::dynamic_pointer_cast<InferredEvidence>(evidence);
+            if (inferred && seen.insert(evidence).second)
+            {
+                counts[nameOf(inferred->production())]++;
+            }
+        }
+    }
+
+    return counts;
+}
+
+
+NetworkStats NetworkStats::of(const InferenceState& state)
+{
+    NetworkStats stats;
+    stats.numWMEs = state.numWMEs();
+    stats.numEvidences = state.numEvidences();
+
+    // which productions support each wme
+    std::unordered_map<const WME*, std::set<std::string>> producers;
+    std::map<Evidence::Ptr, std::string> evidences;
+
+    for (auto& wme : state.getWMEs())
+    {
+        auto& names = producers[wme.get()];
+        for (auto& evidence : state.explain(wme).evidences_)
+        {
+            auto inferred = std::dynamic_pointer_cast<InferredEvidence>(evidence);
+            if (!inferred)
+            {
+                stats.assertedEvidences++;
+                continue;
+            }
+
+            auto name = nameOf(inferred->production());
+            names.insert(name);
+            stats.productions[name].wmes++;
+            evidences.emplace(evidence, name);
+        }
+    }
+
+    // the matches of a production share their parent tokens, count each once
+    std::map<std::string, std::unordered_set<const Token*>> tokensOf;
+
+    for (auto& entry : evidences)
+    {
+        auto& production = stats.productions[entry.second];
+        production.evidences++;
+        production.bytes += sizeof(InferredEvidence);
+
+        auto& seen = tokensOf[entry.second];
+        auto inferred = std::static_pointer_cast<InferredEvidence>(entry.first);
+        for (auto token = inferred->token(); token; token = token->parent)
+        {
+            // its parents have been counted, too
+            if (!seen.insert(token.get()).second) break;
+
+            production.tokens++;
+            production.bytes += sizeof(Token);
+
+            if (!token->wme) continue;
+            auto it = producers.find(token->wme.get());
+            if (it == producers.end()) continue;
+            for (auto& from : it->second)
+            {
+                stats.dependencies[{ from, entry.second }]++;
+            }
+        }
+    }
+
+    return stats;
+}
+
+
+py::dict NetworkStats::toPython() const
+{
+    py::dict productions;
+    for (auto& entry : this->productions)
+    {
+        py::dict p;
+        p["evidences"] = entry.second.evidences;
+        p["wmes"] = entry.second.wmes;
+        p["tokens"] = entry.second.tokens;
+        p["bytes"] = entry.second.bytes;
+        productions[py::str(entry.first)] = p;
+    }
+
+    py::list dependencies;
+    for (auto& entry : this->dependencies)
+    {
+        dependencies.append(py::make_tuple(entry.first.first, entry.first.second, entry.second));
+    }
+
+    py::dict stats;
+    stats["numWMEs"] = numWMEs;
+    stats["numEvidences"] = numEvidences;
+    stats["assertedEvidences"] = assertedEvidences;
+    stats["productions"] = productions;
+    stats["dependencies"] = dependencies;
+    return stats;
+}
+
+
+std::string NetworkStats::toDot() const
+{
+    size_t maxEvidences = 1;
+    size_t maxDependency = 1;
+    for (auto& entry : productions) maxEvidences = std::max(maxEvidences, entry.second.evidences);
+    for (auto& entry : dependencies) maxDependency = std::max(maxDependency, entry.second);
+
+    auto escape = [](const std::string& str)
+    {
+        std::string escaped;
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    };
+    auto quote = [&](const std::string& str) { return "\"" + escape(str) + "\""; };
+
+    std::ostringstream dot;
+    dot << "digraph productions {\n"
+        << "  node [shape=box, style=filled, colorscheme=reds9];\n";
+
+    for (auto& entry : productions)
+    {
+        // heat: colors 1 (few evidences) to 9 (most)
+        int heat = 1 + static_cast<int>(8 * entry.second.evidences / maxEvidences);
+        dot << "  " << quote(entry.first)
+            << " [fillcolor=" << heat << (heat > 6 ? ", fontcolor=white" : "")
+            << ", label=\"" << escape(entry.first) << "\\n"
+            << entry.second.evidences << " evidences, " << entry.second.tokens << " tokens\""
+            << "];\n";
+    }
+
+    for (auto& entry : dependencies)
+    {
+        double width = 1 + 4.0 * entry.second / maxDependency;
+        dot << "  " << quote(entry.first.first) << " -> " << quote(entry.first.second)
+            << " [penwidth=" << width << ", label=" << entry.second << "];\n";
+    }
+
+    dot << "}\n";
+    return dot.str();
+}
@@ -0,0 +1,58 @@
+#ifndef SEMPRPY_NETWORKSTATS_HPP_
+#define SEMPRPY_NETWORKSTATS_HPP_
+
+#include <pybind11/pybind11.h>
+
+#include <rete-reasoner/Reasoner.hpp>
+
+#include <map>
+#include <string>
+#include <utility>
+
+namespace py = pybind11;
+
+
+/**
+    Statistics of the productions (rule effects) of a reasoner, taken from
+    its inference state: the evidences that each production currently
+    holds, the WMEs they support, the tokens they keep alive and a rough
+    estimate of their memory, as well as how often the WMEs inferred by one
+    production are used by another.
+*/
+class NetworkStats {
+public:
+    struct Production {
+        size_t evidences = 0;
+        size_t wmes = 0;
+        size_t tokens = 0;
+        size_t bytes = 0;
+    };
+
+    /** Needs the sempr mutex. */
+    static NetworkStats of(const rete::InferenceState& state);
+
+    /** Number of evidences per production only, cheaper than of(...). */
+    static std::map<std::string, size_t> countEvidences(const rete::InferenceState& state);
+
+    size_t numWMEs = 0;
+    size_t numEvidences = 0;
+    size_t assertedEvidences = 0;
+    std::map<std::string, Production> productions;
+    // (from, to): number of WMEs inferred by "from" that are matched by "to"
+    std::map<std::pair<std::string, std::string>, size_t> dependencies;
+
+    /** Needs the GIL. */
+    py::dict toPython() const;
+
+    /**
+        The productions as a DOT graph, colored by the number of evidences
+        they hold, with edges weighted by the dependencies.
+    */
+    std::string toDot() const;
+
+    /** The name of a production, or its description if it has none. */
+    static std::string nameOf(const rete::Production::Ptr& production);
+};
+
+
+#endif /* include guard: SEMPRPY_NETWORKSTATS_HPP_ */
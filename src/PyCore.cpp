@@ -0,0 +1,554 @@
+#include "PyCore.hpp"
+#include "Threading.hpp"
+#include "WMEIndex.hpp"
+#include "NetworkStats.hpp"
+#include "Tracer.hpp"
+
+#include <sempr/SeparateFileStorage.hpp>
+#include <sempr/ECWMEToJSONConverter.hpp>
+#include <sempr/TupleWMEToJSONConverter.hpp>
+#include <sempr/TupleGeoToJSONConverter.hpp>
+
+#include <rete-reasoner/ExplanationToDotVisitor.hpp>
+#include <rete-reasoner/WMEToJSONConverter.hpp>
+
+#include <cereal/archives/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <string>
+
+using namespace sempr;
+
+
+CallbackBatch::CallbackBatch(py::object callback, size_t numArgs, bool columnar)
+    : callback_(gilSafe(callback)), numArgs_(numArgs), columnar_(columnar)
+{
+}
+
+
+CallbackBatch::Firings CallbackBatch::take()
+{
+    Firings firings;
+    std::swap(firings, firings_);
+    return firings;
+}
+
+
+void CallbackBatch::deliver(const Firings& firings) const
+{
+    const size_t num = firings.flags.size();
+
+    if (columnar_)
+    {
+        py::list flags(num);
+        for (size_t i = 0; i < num; i++) flags[i] = py::cast(firings.flags[i]);
+
+        py::tuple columns(numArgs_ + 1);
+        columns[0] = flags;
+        for (size_t a = 0; a < numArgs_; a++)
+        {
+            py::list column(num);
+            for (size_t i = 0; i < num; i++) column[i] = py::str(firings.args[i*numArgs_ + a]);
+            columns[a+1] = column;
+        }
+
+        (*callback_)(columns);
+    }
+    else
+    {
+        py::list rows(num);
+        for (size_t i = 0; i < num; i++)
+        {
+            py::tuple row(numArgs_ + 1);
+            row[0] = py::cast(firings.flags[i]);
+            for (size_t a = 0; a < numArgs_; a++) row[a+1] = py::str(firings.args[i*numArgs_ + a]);
+            rows[i] = row;
+        }
+
+        (*callback_)(rows);
+    }
+}
+
+
+PyCore::~PyCore()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        stop_ = true;
+    }
+    queueCondition_.notify_all();
+
+    if (worker_.joinable())
+    {
+        // pending tasks need the GIL to resolve their futures
+        py::gil_scoped_release release;
+        worker_.join();
+    }
+
+    if (storage_)
+    {
+        py::gil_scoped_release release;
+        try
+        {
+            storage_->close();
+        }
+        catch (std::exception& e)
+        {
+            py::gil_scoped_acquire gil;
+            PyErr_WarnEx(PyExc_RuntimeWarning,
+                (std::string("failed to write pending entities: ") + e.what()).c_str(), 1);
+        }
+    }
+}
+
+
+void PyCore::performInference()
+{
+    PendingFirings pending;
+    std::exception_ptr error;
+    {
+        CoreLock lock;
+        try
+        {
+            infer();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        // also the firings of a failed run, they must not leak into the next
+        pending = takeCallbackFirings();
+    }
+
+    deliverCallbackFirings(pending, error);
+}
+
+
+void PyCore::infer()
+{
+    TraceSpan span("inference", "performInference");
+
+    // the state changes even if an effect throws halfway
+    struct Invalidate {
+        PyCore* core;
+        ~Invalidate() { core->stateChanged(); }
+    } invalidate{ this };
+
+    if (!profile_.enabled)
+    {
+        Core::performInference();
+        return;
+    }
+
+    auto& state = reasoner().getCurrentState();
+    auto before = NetworkStats::countEvidences(state);
+    auto start = std::chrono::steady_clock::now();
+
+    Core::performInference();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    profile_.runs++;
+    profile_.seconds += seconds;
+    profile_.lastSeconds = seconds;
+    profile_.maxSeconds = std::max(profile_.maxSeconds, seconds);
+
+    auto after = NetworkStats::countEvidences(state);
+    for (auto& entry : after) profile_.evidenceChange[entry.first] += entry.second;
+    for (auto& entry : before) profile_.evidenceChange[entry.first] -= entry.second;
+}
+
+
+void PyCore::addEntity(Entity::Ptr entity)
+{
+    Core::addEntity(entity);
+    spatialIndex_.addEntity(entity);
+    stateChanged();
+}
+
+
+void PyCore::removeEntity(Entity::Ptr entity)
+{
+    Core::removeEntity(entity);
+    spatialIndex_.removeEntity(entity);
+    stateChanged();
+}
+
+
+const SpatialIndex& PyCore::spatialIndex()
+{
+    spatialIndex_.update();
+    return spatialIndex_;
+}
+
+
+namespace {
+    std::mutex& coresMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    std::vector<PyCore*>& cores()
+    {
+        static std::vector<PyCore*> cores;
+        return cores;
+    }
+}
+
+
+PyCore::Registration::Registration(PyCore* core) : core(core)
+{
+    std::lock_guard<std::mutex> lock(coresMutex());
+    cores().push_back(core);
+}
+
+
+PyCore::Registration::~Registration()
+{
+    std::lock_guard<std::mutex> lock(coresMutex());
+    auto& all = cores();
+    all.erase(std::remove(all.begin(), all.end(), core), all.end());
+}
+
+
+PyCore* PyCore::of(const rete::Reasoner& reasoner)
+{
+    std::lock_guard<std::mutex> lock(coresMutex());
+    for (auto core : cores())
+    {
+        if (&core->reasoner() == &reasoner) return core;
+    }
+    return nullptr;
+}
+
+
+PyCore* PyCore::of(const rete::InferenceState& state)
+{
+    std::lock_guard<std::mutex> lock(coresMutex());
+    for (auto core : cores())
+    {
+        if (&core->reasoner().getCurrentState() == &state) return core;
+    }
+    return nullptr;
+}
+
+
+PyCore* PyCore::of(const Entity& entity)
+{
+    std::lock_guard<std::mutex> lock(coresMutex());
+    for (auto core : cores())
+    {
+        if (core->spatialIndex_.tracks(entity)) return core;
+    }
+    return nullptr;
+}
+
+
+void PyCore::stateChanged()
+{
+    generation_++;
+    wmeIndex_.reset();
+    explanationsJSON_.clear();
+    explanationsDOT_.clear();
+}
+
+
+WMEIndex::Ptr PyCore::wmeIndex()
+{
+    if (!wmeIndex_) wmeIndex_ = std::make_shared<WMEIndex>(reasoner().getCurrentState());
+    return wmeIndex_;
+}
+
+
+const nlohmann::json& PyCore::explainAsJSON(rete::WME::Ptr wme)
+{
+    if (auto cached = explanationsJSON_.find(wme)) return *cached;
+
+    // the converters are stateless, share them between all visitors
+    static const std::vector<std::shared_ptr<rete::WMEToJSONConverter>> converters {
+        std::make_shared<TupleWMEToJSONConverter>(),
+        std::make_shared<TupleGeoToJSONConverter>(),
+        std::make_shared<ECWMEToJSONConverter>()
+    };
+
+    rete::ExplanationToJSONVisitor visitor;
+    for (auto& converter : converters) visitor.addToJSONConverter(converter);
+    reasoner().getCurrentState().traverseExplanation(wme, visitor);
+
+    return explanationsJSON_.insert(wme, visitor.json());
+}
+
+
+const std::string& PyCore::explainAsDOT(rete::WME::Ptr wme)
+{
+    if (auto cached = explanationsDOT_.find(wme)) return *cached;
+
+    rete::ExplanationToDotVisitor visitor;
+    reasoner().getCurrentState().traverseExplanation(wme, visitor);
+
+    return explanationsDOT_.insert(wme, visitor.str());
+}
+
+
+void PyCore::loadEntities(const std::string& path, ReservedIDs& ids, size_t threads, py::object progress)
+{
+    TraceSpan span("persistence", "load entities");
+    auto start = std::chrono::steady_clock::now();
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> files;
+    for (auto& entry : fs::directory_iterator(path))
+    {
+        if (fs::is_regular_file(entry.path()) && entry.path().extension() == ".json")
+            files.push_back(entry.path().string());
+    }
+    std::sort(files.begin(), files.end());
+
+    const size_t total = files.size();
+    std::vector<Entity::Ptr> entities(total);
+    std::vector<char> ready(total, 0);
+    std::atomic<size_t> nextFile(0);
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    py::gil_scoped_release release;
+
+    // parse the files in parallel -- like Entity.fromJSON
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < std::min(threads, total); t++)
+    {
+        workers.emplace_back(
+            [&]()
+            {
+                size_t i;
+                while ((i = nextFile++) < total)
+                {
+                    Entity::Ptr entity;
+                    try
+                    {
+                        entity = Entity::create();
+                        std::ifstream file(files[i]);
+                        cereal::JSONInputArchive ar(file);
+                        entity->load(ar);
+
+                        // the storage writes every entity to <id>.json,
+                        // other files are not ours
+                        if (entity->id() != fs::path(files[i]).stem().string()) entity.reset();
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!error) error = std::current_exception();
+                        nextFile = total;
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        entities[i] = entity;
+                        ready[i] = 1;
+                    }
+                    condition.notify_one();
+                }
+            }
+        );
+    }
+
+    // add them to the core in file order, in batches of all that are ready
+    size_t added = 0, loaded = 0;
+    try
+    {
+        while (added < total)
+        {
+            size_t end = added;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&](){ return ready[added] || error; });
+                if (error) break;
+                while (end < total && ready[end]) end++;
+            }
+
+            std::lock_guard<std::recursive_mutex> lock(semprMutex());
+            for (; added < end; added++)
+            {
+                if (!entities[added]) continue;
+
+                // unknown to the storage, which did not load them
+                ids.reserve(entities[added]->id());
+                addEntity(entities[added]);
+                entities[added].reset();
+                loaded++;
+            }
+
+            if (!progress.is_none())
+            {
+                py::gil_scoped_acquire gil;
+                progress(added, total);
+            }
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) error = std::current_exception();
+        nextFile = total;
+    }
+
+    for (auto& worker : workers) worker.join();
+    if (error) std::rethrow_exception(error);
+
+    loadStats_.entities = loaded;
+    loadStats_.threads = threads;
+    loadStats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void PyCore::addCallbackBatch(std::shared_ptr<CallbackBatch> batch)
+{
+    CoreLock lock;
+    callbackBatches_.push_back(batch);
+}
+
+
+PyCore::PendingFirings PyCore::takeCallbackFirings()
+{
+    PendingFirings pending;
+    for (auto& batch : callbackBatches_)
+    {
+        if (!batch->empty()) pending.emplace_back(batch, batch->take());
+    }
+    return pending;
+}
+
+
+void PyCore::deliverCallbackFirings(const PendingFirings& pending, std::exception_ptr runError)
+{
+    // every batch is delivered, the first error is raised afterwards
+    std::exception_ptr error;
+    for (auto& entry : pending)
+    {
+        TraceSpan span("python", "batched callback",
+                       [&]() { return std::to_string(entry.second.flags.size()) + " firings"; });
+        try
+        {
+            entry.first->deliver(entry.second);
+        }
+        catch (py::error_already_set& e)
+        {
+            if (runError) e.discard_as_unraisable("batched callback");
+            else if (!error) error = std::current_exception();
+        }
+        catch (...)
+        {
+            if (!error) error = std::current_exception();
+        }
+    }
+    if (runError) std::rethrow_exception(runError);
+    if (error) std::rethrow_exception(error);
+}
+
+
+py::object PyCore::performInferenceAsync()
+{
+    auto future = gilSafe(py::module_::import("concurrent.futures").attr("Future")());
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        if (!worker_.joinable()) worker_ = std::thread(&PyCore::work, this);
+
+        queue_.push_back(
+            [this, future]()
+            {
+                {
+                    // a cancelled future must not be resolved, skip the run
+                    py::gil_scoped_acquire gil;
+                    try
+                    {
+                        if (!future->attr("set_running_or_notify_cancel")().cast<bool>()) return;
+                    }
+                    catch (py::error_already_set& e)
+                    {
+                        e.discard_as_unraisable("performInferenceAsync");
+                        return;
+                    }
+                }
+
+                std::exception_ptr runError;
+                PendingFirings pending;
+                {
+                    std::lock_guard<std::recursive_mutex> lock(semprMutex());
+                    try
+                    {
+                        infer();
+                    }
+                    catch (std::exception& e)
+                    {
+                        // only the message, the error may hold python objects
+                        runError = std::make_exception_ptr(std::runtime_error(e.what()));
+                    }
+                    // also the firings of a failed run, they must not leak
+                    // into the next
+                    pending = takeCallbackFirings();
+                }
+
+                // nothing may escape the worker thread
+                py::gil_scoped_acquire gil;
+                try
+                {
+                    try
+                    {
+                        deliverCallbackFirings(pending, runError);
+                    }
+                    catch (py::error_already_set& e)
+                    {
+                        future->attr("set_exception")(e.value());
+                        return;
+                    }
+                    catch (std::exception& e)
+                    {
+                        future->attr("set_exception")(py::handle(PyExc_RuntimeError)(e.what()));
+                        return;
+                    }
+                    future->attr("set_result")(py::none());
+                }
+                catch (py::error_already_set& e)
+                {
+                    e.discard_as_unraisable("performInferenceAsync");
+                }
+                catch (std::exception& e)
+                {
+                    PyErr_WarnEx(PyExc_RuntimeWarning, e.what(), 1);
+                }
+            }
+        );
+    }
+    queueCondition_.notify_one();
+
+    return *future;
+}
+
+
+void PyCore::work()
+{
+    std::unique_lock<std::mutex> lock(queueMutex_);
+    while (true)
+    {
+        queueCondition_.wait(lock, [this](){ return stop_ || !queue_.empty(); });
+        if (queue_.empty()) return; // stopped, and nothing left to do
+
+        {
+            // the task must be destroyed before re-locking the queue, as it
+            // needs the GIL to release its future
+            auto task = std::move(queue_.front());
+            queue_.pop_front();
+
+            lock.unlock();
+            task();
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,307 @@
+#ifndef SEMPRPY_PYCORE_HPP_
+#define SEMPRPY_PYCORE_HPP_
+
+#include <pybind11/pybind11.h>
+
+#include <sempr/Core.hpp>
+#include <rete-reasoner/ExplanationToJSONVisitor.hpp>
+
+#include "ExplanationGraph.hpp"
+#include "SpatialIndex.hpp"
+#include "WMEIndex.hpp"
+#include "WriteBehindStorage.hpp"
+#include "LogStorage.hpp"
+#include "ReservedIDs.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace py = pybind11;
+
+
+/**
+    Firings of a batched python callback effect. They are collected natively
+    during inference and handed to python in a single call afterwards, either
+    as a list of (flag, args...) tuples or -- if columnar -- as a tuple of
+    lists ([flags], [arg0s], [arg1s], ...).
+*/
+class CallbackBatch {
+public:
+    struct Firings {
+        std::vector<rete::PropagationFlag> flags;
+        std::vector<std::string> args; // numArgs per firing, flattened
+    };
+
+    CallbackBatch(py::object callback, size_t numArgs, bool columnar);
+
+    template <typename... Ts>
+    void add(rete::PropagationFlag flag, Ts&&... args)
+    {
+        firings_.flags.push_back(flag);
+        int expand[] = { 0, (firings_.args.push_back(std::forward<Ts>(args)), 0)... };
+        (void) expand;
+    }
+
+    bool empty() const { return firings_.flags.empty(); }
+
+    /** Moves the collected firings out of the batch. */
+    Firings take();
+
+    /** Calls the python callback with the given firings. Needs the GIL. */
+    void deliver(const Firings& firings) const;
+
+private:
+    std::shared_ptr<py::object> callback_;
+    size_t numArgs_;
+    bool columnar_;
+    Firings firings_;
+};
+
+
+/**
+    Statistics of loading the persisted entities at startup.
+*/
+struct LoadStats {
+    size_t entities = 0;
+    size_t threads = 0;
+    double seconds = 0;
+};
+
+
+/**
+    Opt-in profile of the inference runs done through the bindings: their
+    duration, and per production the net change of the evidences it holds.
+*/
+struct InferenceProfile {
+    bool enabled = false;
+    size_t runs = 0;
+    double seconds = 0;
+    double lastSeconds = 0;
+    double maxSeconds = 0;
+    std::map<std::string, long> evidenceChange;
+};
+
+
+/**
+    Maps WMEs to derived values, like their explanations, and evicts the
+    least recently used entry when full.
+*/
+template <class V>
+class WMECache {
+public:
+    explicit WMECache(size_t capacity) : capacity_(capacity) {}
+
+    /** The cached value or nullptr. Marks it as recently used. */
+    const V* find(const rete::WME::Ptr& wme)
+    {
+        auto it = index_.find(wme);
+        if (it == index_.end()) return nullptr;
+        items_.splice(items_.begin(), items_, it->second);
+        return &it->second->second;
+    }
+
+    const V& insert(const rete::WME::Ptr& wme, V value)
+    {
+        if (items_.size() >= capacity_)
+        {
+            index_.erase(items_.back().first);
+            items_.pop_back();
+        }
+        items_.emplace_front(wme, std::move(value));
+        index_[wme] = items_.begin();
+        return items_.front().second;
+    }
+
+    void clear() { items_.clear(); index_.clear(); }
+    size_t size() const { return items_.size(); }
+
+private:
+    using Items = std::list<std::pair<rete::WME::Ptr, V>>;
+    size_t capacity_;
+    Items items_; // most recently used first
+    std::map<rete::WME::Ptr, typename Items::iterator, WMEPtrLess> index_;
+};
+
+
+/**
+    The sempr::Core as exposed to python. Adds everything the bindings need
+    to keep track of per core, like the worker thread for asynchronous
+    inference.
+*/
+class PyCore : public sempr::Core {
+public:
+    using sempr::Core::Core;
+    ~PyCore();
+
+    /**
+        Performs inference with the GIL released and delivers the firings of
+        batched callback effects afterwards. Hides
+        sempr::Core::performInference. The GIL must be held by the caller.
+    */
+    void performInference();
+
+    /**
+        Queues an inference run on the background worker of this core and
+        returns a concurrent.futures.Future that is resolved when it is done.
+        Use asyncio.wrap_future(...) to await it.
+    */
+    py::object performInferenceAsync();
+
+    /**
+        Registers a batch that is flushed after every inference run.
+    */
+    void addCallbackBatch(std::shared_ptr<CallbackBatch> batch);
+
+    using PendingFirings = std::vector<std::pair<std::shared_ptr<CallbackBatch>, CallbackBatch::Firings>>;
+
+    /**
+        Takes the firings collected by the batches during inference. Must
+        be called after every inference run, also after a failed one.
+        Needs the sempr mutex.
+    */
+    PendingFirings takeCallbackFirings();
+
+    /**
+        Hands the firings to python, batch by batch. All batches are
+        delivered before the first error is rethrown. If the run failed
+        with runError, that is rethrown instead, and errors of the batches
+        are reported as unraisable. Needs the GIL.
+    */
+    void deliverCallbackFirings(const PendingFirings& pending,
+                                std::exception_ptr runError = nullptr);
+
+    /**
+        The core that owns the reasoner, or nullptr if it is not owned by a
+        core. Needs the sempr mutex.
+    */
+    static PyCore* of(const rete::Reasoner& reasoner);
+    static PyCore* of(const rete::InferenceState& state);
+    /** The core the entity has been added to, or nullptr. */
+    static PyCore* of(const sempr::Entity& entity);
+
+    /**
+        Drops all data derived from the inference state, the WME index and
+        the cached explanations. Called by every binding that modifies the
+        state, including entity and component changes. Needs the sempr mutex.
+    */
+    void stateChanged();
+
+    /**
+        The index of the current inference state, built on first use after
+        every change of the state. Needs the sempr mutex.
+    */
+    WMEIndex::Ptr wmeIndex();
+
+    /**
+        Number of changes of the inference state through the bindings. Used
+        to invalidate data derived from it. Needs the sempr mutex.
+    */
+    size_t generation() const { return generation_; }
+
+    /**
+        Add / remove the entity, track it in the spatial index and call
+        stateChanged. Hide sempr::Core::addEntity / removeEntity. Need the
+        sempr mutex.
+    */
+    void addEntity(sempr::Entity::Ptr entity);
+    void removeEntity(sempr::Entity::Ptr entity);
+
+    /**
+        The index of the GeosGeometry components of all entities added to
+        this core, brought up to date. Needs the sempr mutex.
+    */
+    const SpatialIndex& spatialIndex();
+    /** Number of entries in the index, without bringing it up to date. */
+    size_t spatialIndexSize() const { return spatialIndex_.size(); }
+
+    /**
+        The explanation of the wme as JSON / DOT. The most recently used
+        results are cached until the next stateChanged, i.e. until an
+        inference run, an evidence or an entity or component is added or
+        removed. Need the sempr mutex.
+    */
+    const nlohmann::json& explainAsJSON(rete::WME::Ptr wme);
+    const std::string& explainAsDOT(rete::WME::Ptr wme);
+    size_t explanationCacheSize() const
+    {
+        return explanationsJSON_.size() + explanationsDOT_.size();
+    }
+
+    /**
+        Loads all entity files (<id>.json, as written by the
+        SeparateFileStorage) from the given directory, parsing them on the
+        given number of threads (0: one per core). JSON files that do not
+        hold the entity of their name are skipped. The parsed entities are
+        added in file order, in batches, as soon as they are ready, and
+        their ids are reserved in ids, which must be the id generator of
+        this core. progress (if not None) is called as
+        progress(processed, total) after each batch. The GIL must be held by
+        the caller.
+    */
+    void loadEntities(const std::string& path, ReservedIDs& ids, size_t threads, py::object progress);
+
+    /** Needs the sempr mutex. */
+    InferenceProfile& profile() { return profile_; }
+
+    const LoadStats& loadStats() const { return loadStats_; }
+    void setLoadStats(const LoadStats& stats) { loadStats_ = stats; }
+
+    /**
+        The persistence module of this core, if any. It is closed -- i.e.
+        all pending writes are flushed -- when the core is destroyed.
+    */
+    WriteBehindStorage::Ptr storage() const { return storage_; }
+    void setStorage(WriteBehindStorage::Ptr storage) { storage_ = storage; }
+
+    /** The log file backend, if the core persists to one. */
+    LogStorage::Ptr logStorage() const { return logStorage_; }
+    void setLogStorage(LogStorage::Ptr log) { logStorage_ = log; }
+
+private:
+    LoadStats loadStats_;
+    WriteBehindStorage::Ptr storage_;
+    LogStorage::Ptr logStorage_;
+
+    // guarded by the sempr mutex
+    size_t generation_ = 0;
+    InferenceProfile profile_;
+    SpatialIndex spatialIndex_;
+
+    WMEIndex::Ptr wmeIndex_;
+    WMECache<nlohmann::json> explanationsJSON_{1024};
+    WMECache<std::string> explanationsDOT_{1024};
+
+    // registers the core to be found by PyCore::of
+    struct Registration {
+        explicit Registration(PyCore* core);
+        ~Registration();
+        PyCore* core;
+    } registration_{this};
+
+    /** Core::performInference, and stateChanged. Needs the sempr mutex. */
+    void infer();
+
+    // guarded by the sempr mutex
+    std::vector<std::shared_ptr<CallbackBatch>> callbackBatches_;
+
+    std::mutex queueMutex_;
+    std::condition_variable queueCondition_;
+    std::deque<std::function<void()>> queue_;
+    bool stop_ = false;
+    std::thread worker_;
+
+    void work();
+};
+
+
+#endif /* include guard: SEMPRPY_PYCORE_HPP_ */
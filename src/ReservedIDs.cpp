@@ -0,0 +1,28 @@
+#include "ReservedIDs.hpp"
+
+using namespace sempr;
+
+
+ReservedIDs::ReservedIDs(IDGenerator::Ptr generator)
+    : generator_(generator)
+{
+}
+
+
+std::string ReservedIDs::createIDFor(Entity::Ptr entity)
+{
+    // the wrapped generator keeps the skipped ids, so they are not retried
+    std::string id;
+    do {
+        id = generator_->createIDFor(entity);
+    } while (reserved_.count(id));
+
+    return id;
+}
+
+
+void ReservedIDs::releaseIDOf(Entity::Ptr entity)
+{
+    reserved_.erase(entity->id());
+    generator_->releaseIDOf(entity);
+}
@@ -0,0 +1,35 @@
+#ifndef SEMPRPY_RESERVEDIDS_HPP_
+#define SEMPRPY_RESERVEDIDS_HPP_
+
+#include <sempr/IDGenerator.hpp>
+#include <sempr/Entity.hpp>
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+
+/**
+    An IDGenerator that forwards to another one, but never hands out the
+    ids reserved in it -- e.g. those of entities that were loaded without
+    going through the persistence module, which therefore does not know
+    them. Needs the sempr mutex.
+*/
+class ReservedIDs : public sempr::IDGenerator {
+public:
+    using Ptr = std::shared_ptr<ReservedIDs>;
+
+    ReservedIDs(sempr::IDGenerator::Ptr generator);
+
+    void reserve(const std::string& id) { reserved_.insert(id); }
+
+    std::string createIDFor(sempr::Entity::Ptr entity) override;
+    void releaseIDOf(sempr::Entity::Ptr entity) override;
+
+private:
+    sempr::IDGenerator::Ptr generator_;
+    std::unordered_set<std::string> reserved_;
+};
+
+
+#endif /* include guard: SEMPRPY_RESERVEDIDS_HPP_ */
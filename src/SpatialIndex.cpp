@@ -0,0 +1,226 @@
+#include "SpatialIndex.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+
+using namespace sempr;
+
+
+namespace {
+    // all live indices, to broadcast changes of entities that may be
+    // tracked by any of them
+    std::mutex& registryMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    std::vector<SpatialIndex*>& registry()
+    {
+        static std::vector<SpatialIndex*> indices;
+        return indices;
+    }
+}
+
+
+SpatialIndex::SpatialIndex()
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().push_back(this);
+}
+
+
+SpatialIndex::~SpatialIndex()
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    auto& indices = registry();
+    indices.erase(std::remove(indices.begin(), indices.end(), this), indices.end());
+}
+
+
+void SpatialIndex::addEntity(const Entity::Ptr& entity)
+{
+    if (!entities_.emplace(entity.get(), entity).second) return;
+
+    for (auto& entry : entity->getComponentsWithTag<GeosGeometry>())
+    {
+        add(entity, entry.first);
+    }
+}
+
+
+void SpatialIndex::removeEntity(const Entity::Ptr& entity)
+{
+    if (!entities_.erase(entity.get())) return;
+
+    auto it = entries_.lower_bound(Key(entity.get(), nullptr));
+    while (it != entries_.end() && it->first.first == entity.get())
+    {
+        auto key = (it++)->first;
+        remove(key);
+    }
+}
+
+
+void SpatialIndex::componentAdded(const Entity::Ptr& entity, const Component::Ptr& component)
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    for (auto index : registry())
+    {
+        if (index->entities_.count(entity.get())) index->add(entity, component);
+    }
+}
+
+
+void SpatialIndex::componentRemoved(const Entity::Ptr& entity, const Component::Ptr& component)
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    for (auto index : registry())
+    {
+        if (index->entries_.count(Key(entity.get(), component.get())))
+        {
+            index->remove(Key(entity.get(), component.get()));
+        }
+    }
+}
+
+
+void SpatialIndex::entityChanged(const Entity::Ptr& entity)
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    for (auto index : registry())
+    {
+        if (index->entities_.count(entity.get()))
+        {
+            index->removeEntity(entity);
+            index->addEntity(entity);
+        }
+    }
+}
+
+
+void SpatialIndex::geometryChanged(const Component* component)
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    for (auto index : registry())
+    {
+        if (index->byComponent_.count(component)) index->stale_.insert(component);
+    }
+}
+
+
+void SpatialIndex::add(const Entity::Ptr& entity, const Component::Ptr& component)
+{
+    auto geometry = std::dynamic_pointer_cast<GeosGeometry>(component);
+    if (!geometry) return;
+
+    Key key(entity.get(), component.get());
+    auto& entry = entries_[key];
+    if (entry) return;
+
+    entry.reset(new Entry{ entity, geometry, geos::geom::Envelope(), false });
+    byComponent_[component.get()].insert(key);
+    refresh(*entry);
+}
+
+
+void SpatialIndex::remove(const Key& key)
+{
+    auto it = entries_.find(key);
+    if (it == entries_.end()) return;
+
+    auto& entry = *it->second;
+    if (entry.inTree) tree_.remove(&entry.envelope, &entry);
+
+    auto byComponent = byComponent_.find(key.second);
+    byComponent->second.erase(key);
+    if (byComponent->second.empty())
+    {
+        byComponent_.erase(byComponent);
+        stale_.erase(key.second);
+    }
+
+    entries_.erase(it);
+}
+
+
+void SpatialIndex::refresh(Entry& entry)
+{
+    auto geometry = entry.component->geometry();
+    bool indexed = geometry && !geometry->isEmpty();
+
+    if (indexed && entry.inTree && *geometry->getEnvelopeInternal() == entry.envelope) return;
+
+    if (entry.inTree) tree_.remove(&entry.envelope, &entry);
+    entry.inTree = indexed;
+    if (indexed)
+    {
+        entry.envelope = *geometry->getEnvelopeInternal();
+        tree_.insert(&entry.envelope, &entry);
+    }
+}
+
+
+void SpatialIndex::update()
+{
+    for (auto component : stale_)
+    {
+        for (auto& key : byComponent_[component])
+        {
+            refresh(*entries_[key]);
+        }
+    }
+    stale_.clear();
+}
+
+
+std::vector<Entity::Ptr> SpatialIndex::query(const geos::geom::Geometry& query,
+                                             const std::string& predicate) const
+{
+    using geos::geom::Geometry;
+    static const std::map<std::string, std::function<bool(const Geometry*, const Geometry*)>> predicates {
+        { "intersects", [](const Geometry* a, const Geometry* b) { return a->intersects(b); } },
+        { "within",     [](const Geometry* a, const Geometry* b) { return a->within(b); } },
+        { "contains",   [](const Geometry* a, const Geometry* b) { return a->contains(b); } },
+        { "covers",     [](const Geometry* a, const Geometry* b) { return a->covers(b); } },
+        { "coveredBy",  [](const Geometry* a, const Geometry* b) { return a->coveredBy(b); } },
+        { "touches",    [](const Geometry* a, const Geometry* b) { return a->touches(b); } },
+        { "overlaps",   [](const Geometry* a, const Geometry* b) { return a->overlaps(b); } },
+        { "crosses",    [](const Geometry* a, const Geometry* b) { return a->crosses(b); } },
+        { "equals",     [](const Geometry* a, const Geometry* b) { return a->equals(b); } },
+    };
+
+    auto test = predicates.find(predicate);
+    if (test == predicates.end())
+        throw std::invalid_argument("unknown spatial predicate: " + predicate);
+
+    std::vector<Entity::Ptr> entities;
+    if (query.isEmpty()) return entities;
+
+    // all predicates require the envelopes to intersect
+    const auto& envelope = *query.getEnvelopeInternal();
+    std::vector<void*> candidates;
+    tree_.query(&envelope, candidates);
+
+    std::unordered_set<const Entity*> found;
+    for (auto candidate : candidates)
+    {
+        auto entry = static_cast<const Entry*>(candidate);
+        if (!entry->envelope.intersects(envelope)) continue;
+        if (found.count(entry->entity.get())) continue;
+
+        // resolved now, the setters of the component replace the geometry
+        auto geometry = entry->component->geometry();
+        if (!geometry || geometry->isEmpty()) continue;
+
+        if (test->second(geometry, &query))
+        {
+            found.insert(entry->entity.get());
+            entities.push_back(entry->entity);
+        }
+    }
+
+    return entities;
+}
@@ -0,0 +1,93 @@
+#ifndef SEMPRPY_SPATIALINDEX_HPP_
+#define SEMPRPY_SPATIALINDEX_HPP_
+
+#include <sempr/Entity.hpp>
+#include <sempr/component/GeosGeometry.hpp>
+
+#include <geos/geom/Envelope.h>
+#include <geos/geom/Geometry.h>
+#include <geos/index/quadtree/Quadtree.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+
+/**
+    Index over the envelopes of the GeosGeometry components of all entities
+    added to a core. A quadtree is used, as it -- unlike the STRtree --
+    supports insertion and removal after it has been queried.
+
+    The index is maintained incrementally: the core reports added and removed
+    entities, and the bindings that add or remove components or change a
+    geometry notify all live indices through the static functions below. The
+    geometries themselves are never stored, but resolved from the components
+    when querying, as every setter replaces them. All of this needs the sempr
+    mutex.
+*/
+class SpatialIndex {
+public:
+    SpatialIndex();
+    ~SpatialIndex();
+    SpatialIndex(const SpatialIndex&) = delete;
+    SpatialIndex& operator = (const SpatialIndex&) = delete;
+
+    void addEntity(const sempr::Entity::Ptr& entity);
+    void removeEntity(const sempr::Entity::Ptr& entity);
+
+    /** Notify all indices that track the entity. */
+    static void componentAdded(const sempr::Entity::Ptr& entity, const sempr::Component::Ptr& component);
+    static void componentRemoved(const sempr::Entity::Ptr& entity, const sempr::Component::Ptr& component);
+    /** Notify all indices that the components of the entity were replaced. */
+    static void entityChanged(const sempr::Entity::Ptr& entity);
+    /** Notify all indices that the geometry of the component may have changed. */
+    static void geometryChanged(const sempr::Component* component);
+
+    /**
+        Re-reads the envelopes of all components whose geometry changed since
+        the last update.
+    */
+    void update();
+
+    /**
+        Returns all entities with a geometry that fulfills the predicate
+        w.r.t. the given geometry, i.e. geometry.<predicate>(query). Known
+        predicates are intersects, within, contains, covers, coveredBy,
+        touches, overlaps, crosses and equals. Call update() first.
+    */
+    std::vector<sempr::Entity::Ptr> query(const geos::geom::Geometry& query,
+                                          const std::string& predicate) const;
+
+    size_t size() const { return entries_.size(); }
+    /** Whether the entity has been added to this index. */
+    bool tracks(const sempr::Entity& entity) const { return entities_.count(&entity) > 0; }
+
+private:
+    struct Entry {
+        sempr::Entity::Ptr entity;
+        std::shared_ptr<sempr::GeosGeometry> component;
+        geos::geom::Envelope envelope;
+        bool inTree = false;
+    };
+
+    using Key = std::pair<const sempr::Entity*, const sempr::Component*>;
+
+    void add(const sempr::Entity::Ptr& entity, const sempr::Component::Ptr& component);
+    void remove(const Key& key);
+    void refresh(Entry& entry);
+
+    // the tracked entities are kept alive, so their addresses are not reused
+    std::unordered_map<const sempr::Entity*, sempr::Entity::Ptr> entities_;
+    std::map<Key, std::unique_ptr<Entry>> entries_;
+    std::unordered_map<const sempr::Component*, std::set<Key>> byComponent_;
+    std::unordered_set<const sempr::Component*> stale_;
+    mutable geos::index::quadtree::Quadtree tree_;
+};
+
+
+#endif /* include guard: SEMPRPY_SPATIALINDEX_HPP_ */
@@ -0,0 +1,69 @@
+#include "TermDictionary.hpp"
+
+#include <limits>
+#include <stdexcept>
+
+
+TermDictionary& TermDictionary::instance()
+{
+    // never destroyed: the python strs must not be released after the
+    // interpreter has been finalized
+    static TermDictionary* dictionary = new TermDictionary();
+    return *dictionary;
+}
+
+
+TermDictionary::Handle TermDictionary::intern(const std::string& term)
+{
+    auto it = handles_.find(term);
+    if (it != handles_.end()) return it->second;
+
+    if (terms_.size() >= std::numeric_limits<Handle>::max())
+        throw std::overflow_error("too many terms");
+
+    // everything that may throw (e.g. for invalid UTF-8) comes before the
+    // insertion, so the containers stay in sync
+    py::str str(term);
+    terms_.reserve(terms_.size() + 1);
+    strs_.reserve(strs_.size() + 1);
+
+    Handle handle = static_cast<Handle>(terms_.size());
+    it = handles_.emplace(term, handle).first;
+    terms_.push_back(&it->first);
+    strs_.push_back(std::move(str));
+    return handle;
+}
+
+
+bool TermDictionary::find(const std::string& term, Handle& handle) const
+{
+    auto it = handles_.find(term);
+    if (it == handles_.end()) return false;
+    handle = it->second;
+    return true;
+}
+
+
+const std::string& TermDictionary::term(Handle handle) const
+{
+    if (handle >= terms_.size()) throw py::index_error("unknown term handle");
+    return *terms_[handle];
+}
+
+
+py::str TermDictionary::str(Handle handle) const
+{
+    if (handle >= strs_.size()) throw py::index_error("unknown term handle");
+    return strs_[handle];
+}
+
+
+py::str TermDictionary::str(const std::string& term)
+{
+    Handle handle;
+    if (find(term, handle)) return strs_[handle];
+
+    bool uri = term.size() >= 2 && term.front() == '<' && term.back() == '>';
+    if (!uri || terms_.size() >= limit_) return py::str(term);
+    return strs_[intern(term)];
+}
@@ -0,0 +1,64 @@
+#ifndef SEMPRPY_TERMDICTIONARY_HPP_
+#define SEMPRPY_TERMDICTIONARY_HPP_
+
+#include <pybind11/pybind11.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace py = pybind11;
+
+
+/**
+    Interns the terms (URIs and literals) of triples to integer handles and
+    keeps one python str per handle. The triple getters return these
+    cached strs, so repeated terms are converted and allocated only once,
+    and python code can work with the handles instead of the strings.
+
+    The triples in sempr and rete still store their own std::strings; the
+    dictionary only deduplicates on the python side. Terms are never
+    removed, hence the getters only intern URIs, which recur, and stop
+    once the limit is reached. Literals, which are often one-off values,
+    are only shared if they have been interned explicitly, which is always
+    possible.
+
+    All methods need the GIL.
+*/
+class TermDictionary {
+public:
+    using Handle = uint32_t;
+
+    static TermDictionary& instance();
+
+    Handle intern(const std::string& term);
+
+    /** Whether the term is known, and its handle if so. */
+    bool find(const std::string& term, Handle& handle) const;
+
+    const std::string& term(Handle handle) const;
+    py::str str(Handle handle) const;
+
+    /**
+        The interned python str of the term. Interns URIs (<...>) if the
+        limit has not been reached yet, returns a new str for anything else
+        that is not interned.
+    */
+    py::str str(const std::string& term);
+
+    size_t size() const { return terms_.size(); }
+    size_t limit() const { return limit_; }
+    void setLimit(size_t limit) { limit_ = limit; }
+
+private:
+    TermDictionary() = default;
+
+    std::unordered_map<std::string, Handle> handles_;
+    std::vector<const std::string*> terms_; // keys of handles_
+    std::vector<py::str> strs_;
+    size_t limit_ = 1000000;
+};
+
+
+#endif /* include guard: SEMPRPY_TERMDICTIONARY_HPP_ */
@@ -0,0 +1,57 @@
+#ifndef SEMPRPY_THREADING_HPP_
+#define SEMPRPY_THREADING_HPP_
+
+#include <pybind11/pybind11.h>
+
+#include <memory>
+#include <mutex>
+
+namespace py = pybind11;
+
+
+/**
+    The mutex that serializes every access to sempr objects from python.
+    Entities and components reach into the core they have been added to, so
+    a single lock is used instead of one per core.
+*/
+inline std::recursive_mutex& semprMutex()
+{
+    static std::recursive_mutex mutex;
+    return mutex;
+}
+
+
+/**
+    Releases the GIL and locks the sempr mutex -- in this order. A thread
+    waiting for the mutex hence never blocks other python threads, and the
+    thread holding the mutex can always re-acquire the GIL, e.g. to run a
+    python callback effect during inference.
+
+    Use it as py::call_guard<CoreLock>() or as a scoped guard inside of a
+    binding. The GIL must be held when it is constructed.
+*/
+struct CoreLock {
+    py::gil_scoped_release release;
+    std::unique_lock<std::recursive_mutex> lock{semprMutex()};
+};
+
+
+/**
+    Wraps a python object in a shared_ptr that may be copied and destroyed
+    without holding the GIL, e.g. inside of std::functions that are stored in
+    the rete network. Only the last owner acquires the GIL to drop the
+    reference.
+*/
+inline std::shared_ptr<py::object> gilSafe(py::object obj)
+{
+    return std::shared_ptr<py::object>(
+        new py::object(std::move(obj)),
+        [](py::object* o)
+        {
+            py::gil_scoped_acquire gil;
+            delete o;
+        }
+    );
+}
+
+#endif /* include guard: SEMPRPY_THREADING_HPP_ */
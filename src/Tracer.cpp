@@ -0,0 +1,84 @@
+#include "Tracer.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <fstream>
+#include <stdexcept>
+
+
+Tracer& Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+
+void Tracer::start(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (enabled_) throw std::runtime_error("a trace is already being recorded");
+
+    path_ = path;
+    events_.clear();
+    threads_.clear();
+    start_ = Clock::now();
+    enabled_ = true;
+}
+
+
+size_t Tracer::stop()
+{
+    std::vector<Event> events;
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!enabled_) throw std::runtime_error("no trace is being recorded");
+
+        enabled_ = false;
+        std::swap(events, events_);
+        std::swap(path, path_);
+    }
+
+    nlohmann::json trace = nlohmann::json::array();
+    for (auto& event : events)
+    {
+        nlohmann::json e = {
+            { "name", event.name },
+            { "cat", event.category },
+            { "ph", "X" },
+            { "ts", event.begin },
+            { "dur", event.duration },
+            { "pid", 1 },
+            { "tid", event.thread }
+        };
+        if (!event.detail.empty()) e["args"] = { { "detail", event.detail } };
+        trace.push_back(std::move(e));
+    }
+
+    std::ofstream out(path);
+    out << nlohmann::json{ { "traceEvents", trace }, { "displayTimeUnit", "ms" } };
+    if (!out) throw std::runtime_error("failed to write trace to " + path);
+
+    return events.size();
+}
+
+
+void Tracer::record(const char* category, const char* name,
+                    Clock::time_point begin, Clock::time_point end,
+                    const std::string& detail)
+{
+    using us = std::chrono::microseconds;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_ || begin < start_) return;
+
+    // small, stable thread ids for the viewer
+    auto inserted = threads_.emplace(std::this_thread::get_id(), threads_.size() + 1);
+
+    events_.push_back(Event{
+        category, name, detail,
+        std::chrono::duration_cast<us>(begin - start_).count(),
+        std::chrono::duration_cast<us>(end - begin).count(),
+        inserted.first->second
+    });
+}
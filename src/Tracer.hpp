@@ -0,0 +1,98 @@
+#ifndef SEMPRPY_TRACER_HPP_
+#define SEMPRPY_TRACER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+    Records timestamped spans (inference runs, python callbacks, persistence)
+    while enabled, and writes them as a Chrome trace (JSON) that can be
+    opened in chrome://tracing or Perfetto. There is a single tracer per
+    process, as spans are recorded from places that do not know their core.
+*/
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static Tracer& instance();
+
+    /** Starts recording, to be written to the given file. */
+    void start(const std::string& path);
+
+    /** Stops recording and writes the trace. Returns the number of spans. */
+    size_t stop();
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void record(const char* category, const char* name,
+                Clock::time_point begin, Clock::time_point end,
+                const std::string& detail);
+
+private:
+    struct Event {
+        const char* category;
+        std::string name;
+        std::string detail;
+        long long begin; // us since start
+        long long duration;
+        size_t thread;
+    };
+
+    std::atomic<bool> enabled_{false};
+    std::mutex mutex_;
+    std::string path_;
+    Clock::time_point start_;
+    std::vector<Event> events_;
+    std::unordered_map<std::thread::id, size_t> threads_;
+};
+
+
+/**
+    Records a span from its construction to its destruction, if tracing is
+    enabled at construction. The name must outlive the span. The detail is
+    given as a function that builds it, which is only called if tracing is
+    enabled, so that disabled spans cost no allocations.
+*/
+class TraceSpan {
+public:
+    TraceSpan(const char* category, const char* name)
+        : enabled_(Tracer::instance().enabled())
+    {
+        if (!enabled_) return;
+        category_ = category;
+        name_ = name;
+        begin_ = Tracer::Clock::now();
+    }
+
+    template <class Detail>
+    TraceSpan(const char* category, const char* name, Detail detail)
+        : TraceSpan(category, name)
+    {
+        if (enabled_) detail_ = detail();
+    }
+
+    ~TraceSpan()
+    {
+        if (enabled_)
+            Tracer::instance().record(category_, name_, begin_, Tracer::Clock::now(), detail_);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    bool enabled_;
+    const char* category_ = nullptr;
+    const char* name_ = nullptr;
+    std::string detail_;
+    Tracer::Clock::time_point begin_;
+};
+
+
+#endif /* include guard: SEMPRPY_TRACER_HPP_ */
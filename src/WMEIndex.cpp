@@ -0,0 +1,118 @@
+#include "WMEIndex.hpp"
+
+#include <sempr/ECWME.hpp>
+#include <rete-core/Token.hpp>
+#include <rete-reasoner/RuleParser.hpp>
+
+#include <stdexcept>
+
+using namespace rete;
+
+
+WMEIndex::Kind WMEIndex::kindByName(const std::string& name)
+{
+    if (name == "Triple") return TRIPLE;
+    if (name == "ECWME") return ECWME;
+    if (name == "TokenGroup") return TOKENGROUP;
+    if (name == "WME") return ALL;
+    throw std::invalid_argument("unknown WME type: " + name);
+}
+
+
+WMEIndex::WMEIndex(const InferenceState& state)
+{
+    byKind_[ALL] = state.getWMEs();
+    for (auto& wme : byKind_[ALL])
+    {
+        auto triple = std::dynamic_pointer_cast<Triple>(wme);
+        if (triple)
+        {
+            const uint32_t pos = static_cast<uint32_t>(triples_.size());
+            triples_.push_back(triple);
+            bySubject_[&triple->subject].push_back(pos);
+            byPredicate_[&triple->predicate].push_back(pos);
+            byObject_[&triple->object].push_back(pos);
+            byKind_[TRIPLE].push_back(wme);
+        }
+        else if (std::dynamic_pointer_cast<sempr::ECWME>(wme))
+        {
+            byKind_[ECWME].push_back(wme);
+        }
+        else if (std::dynamic_pointer_cast<TokenGroup>(wme))
+        {
+            byKind_[TOKENGROUP].push_back(wme);
+        }
+        else
+        {
+            byKind_[OTHER].push_back(wme);
+        }
+    }
+
+    inferred_.resize(triples_.size(), -1);
+}
+
+
+bool WMEIndex::isInferred(const InferenceState& state, uint32_t pos)
+{
+    auto& known = inferred_[pos];
+    if (known == -1)
+    {
+        known = 1;
+        for (auto& evidence : state.explain(triples_[pos]).evidences_)
+        {
+            if (!std::dynamic_pointer_cast<InferredEvidence>(evidence))
+            {
+                known = 0;
+                break;
+            }
+        }
+    }
+    return known == 1;
+}
+
+
+std::vector<uint32_t> WMEIndex::find(const InferenceState& state,
+                                     const std::string& s, const std::string& p, const std::string& o,
+                                     bool inferredOnly)
+{
+    // start with the smallest posting list of the bound fields
+    static const std::vector<uint32_t> none;
+    const std::vector<uint32_t>* candidates = nullptr;
+    bool bound = false;
+
+    auto narrow = [&](const Postings& postings, const std::string& value)
+    {
+        if (value.empty()) return;
+        bound = true;
+
+        auto it = postings.find(&value);
+        const auto& list = (it == postings.end() ? none : it->second);
+        if (!candidates || list.size() < candidates->size()) candidates = &list;
+    };
+
+    narrow(bySubject_, s);
+    narrow(byPredicate_, p);
+    narrow(byObject_, o);
+
+    std::vector<uint32_t> result;
+    auto test = [&](uint32_t pos)
+    {
+        auto& t = *triples_[pos];
+        if (!s.empty() && t.subject != s) return;
+        if (!p.empty() && t.predicate != p) return;
+        if (!o.empty() && t.object != o) return;
+        if (inferredOnly && !isInferred(state, pos)) return;
+        result.push_back(pos);
+    };
+
+    if (bound)
+    {
+        for (auto pos : *candidates) test(pos);
+    }
+    else
+    {
+        for (uint32_t pos = 0; pos < triples_.size(); pos++) test(pos);
+    }
+
+    return result;
+}
@@ -0,0 +1,76 @@
+#ifndef SEMPRPY_WMEINDEX_HPP_
+#define SEMPRPY_WMEINDEX_HPP_
+
+#include <rete-core/WME.hpp>
+#include <rete-rdf/Triple.hpp>
+#include <rete-reasoner/Reasoner.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+    Index over the WMEs of an inference state: the WMEs grouped by type,
+    and the rete::Triples by subject, predicate and object. Built once per
+    state of the inference, queried any number of times. The index refers
+    to the terms of the triples it holds instead of copying them.
+
+    The index does not track the state: its owner (see PyCore::wmeIndex)
+    must drop it when the state changes.
+*/
+class WMEIndex {
+public:
+    using Ptr = std::shared_ptr<WMEIndex>;
+
+    enum Kind {
+        TRIPLE = 0,
+        ECWME = 1,
+        TOKENGROUP = 2,
+        OTHER = 3,
+        ALL = 4
+    };
+
+    /** Triple, ECWME, TokenGroup or WME (for all). */
+    static Kind kindByName(const std::string& name);
+
+    explicit WMEIndex(const rete::InferenceState& state);
+
+    /**
+        Positions of the triples matching the pattern. Empty strings are
+        wildcards. With inferredOnly, triples that are (also) asserted are
+        skipped, which needs the state the index was built from, and the
+        sempr mutex.
+    */
+    std::vector<uint32_t> find(const rete::InferenceState& state,
+                               const std::string& s, const std::string& p, const std::string& o,
+                               bool inferredOnly);
+
+    const std::vector<rete::Triple::Ptr>& triples() const { return triples_; }
+    const std::vector<rete::WME::Ptr>& wmes(Kind kind) const { return byKind_[kind]; }
+
+private:
+    // keyed by the terms of the triples in triples_, compared by value
+    struct TermHash {
+        size_t operator()(const std::string* term) const { return std::hash<std::string>()(*term); }
+    };
+    struct TermEqual {
+        bool operator()(const std::string* a, const std::string* b) const { return *a == *b; }
+    };
+    using Postings = std::unordered_map<const std::string*, std::vector<uint32_t>, TermHash, TermEqual>;
+
+    std::vector<rete::WME::Ptr> byKind_[5];
+    std::vector<rete::Triple::Ptr> triples_;
+    Postings bySubject_, byPredicate_, byObject_;
+
+    // -1: not yet known, 0: asserted, 1: only inferred
+    std::vector<int8_t> inferred_;
+
+    bool isInferred(const rete::InferenceState& state, uint32_t triple);
+};
+
+
+#endif /* include guard: SEMPRPY_WMEINDEX_HPP_ */
@@ -0,0 +1,229 @@
+#include "WriteBehindStorage.hpp"
+#include "Threading.hpp"
+#include "Tracer.hpp"
+
+#include <string>
+
+using namespace sempr;
+
+
+WriteBehindStorage::WriteBehindStorage(DBConnection::Ptr storage)
+    : storage_(storage)
+{
+}
+
+
+WriteBehindStorage::~WriteBehindStorage()
+{
+    // errors cannot be reported anymore
+    try { close(); } catch (...) {}
+}
+
+
+void WriteBehindStorage::close()
+{
+    {
+        // only once: the destructor may run with the GIL held, and must not
+        // block on the sempr mutex then
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_) return;
+        closed_ = true;
+        stop_ = true;
+        interval_ = std::chrono::duration<double>(0);
+    }
+    condition_.notify_all();
+    if (flusher_.joinable()) flusher_.join();
+
+    flush();
+}
+
+
+void WriteBehindStorage::setWriteBehind(double interval, size_t threshold)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        interval_ = std::chrono::duration<double>(interval > 0 ? interval : 0);
+        threshold_ = threshold;
+        if (interval > 0 && !stop_ && !flusher_.joinable())
+        {
+            flusher_ = std::thread(&WriteBehindStorage::run, this);
+        }
+    }
+    condition_.notify_all();
+
+    if (interval <= 0) flush();
+}
+
+
+void WriteBehindStorage::flush()
+{
+    write();
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(error, error_);
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+
+bool WriteBehindStorage::writeBehind() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return interval_.count() > 0;
+}
+
+
+size_t WriteBehindStorage::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+
+std::vector<Entity::Ptr> WriteBehindStorage::loadAll() const
+{
+    return storage_->loadAll();
+}
+
+
+void WriteBehindStorage::save(std::vector<Entity::Ptr>& entities)
+{
+    if (!writeBehind())
+    {
+        TraceSpan span("persistence", "save", [&]() { return std::to_string(entities.size()) + " entities"; });
+        return storage_->save(entities);
+    }
+    for (auto& entity : entities) enqueue(entity, false);
+}
+
+
+void WriteBehindStorage::remove(std::vector<Entity::Ptr>& entities)
+{
+    if (!writeBehind())
+    {
+        TraceSpan span("persistence", "remove", [&]() { return std::to_string(entities.size()) + " entities"; });
+        return storage_->remove(entities);
+    }
+    for (auto& entity : entities) enqueue(entity, true);
+}
+
+
+void WriteBehindStorage::save(Entity::Ptr entity)
+{
+    if (!writeBehind())
+    {
+        TraceSpan span("persistence", "save", [&]() { return entity->id(); });
+        return storage_->save(entity);
+    }
+    enqueue(entity, false);
+}
+
+
+void WriteBehindStorage::remove(Entity::Ptr entity)
+{
+    if (!writeBehind())
+    {
+        TraceSpan span("persistence", "remove", [&]() { return entity->id(); });
+        return storage_->remove(entity);
+    }
+    enqueue(entity, true);
+}
+
+
+void WriteBehindStorage::enqueue(Entity::Ptr entity, bool removed)
+{
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // the last operation on an entity wins
+        pending_[entity.get()] = Pending{ entity, removed };
+        full = threshold_ > 0 && pending_.size() >= threshold_;
+    }
+    if (full) condition_.notify_all();
+}
+
+
+void WriteBehindStorage::write()
+{
+    {
+        // nothing to do, don't wait for the sempr mutex
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) return;
+    }
+
+    // taken before the pending entities, so that no synchronous write of an
+    // entity can come between taking and writing an older state of it, and
+    // the entities are serialized while nobody modifies them
+    std::lock_guard<std::recursive_mutex> semprLock(semprMutex());
+
+    std::unordered_map<const Entity*, Pending> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(pending, pending_);
+    }
+    if (pending.empty()) return;
+
+    std::vector<Entity::Ptr> saved, removed;
+    for (auto& entry : pending)
+    {
+        (entry.second.removed ? removed : saved).push_back(entry.second.entity);
+    }
+
+    TraceSpan span("persistence", "write behind",
+                   [&]() { return std::to_string(saved.size()) + " saved, " + std::to_string(removed.size()) + " removed"; });
+    try
+    {
+        if (!removed.empty()) storage_->remove(removed);
+        if (!saved.empty()) storage_->save(saved);
+    }
+    catch (...)
+    {
+        // keep the batch for the next flush, behind anything newer
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& entry : pending) pending_.emplace(entry.first, entry.second);
+        throw;
+    }
+}
+
+
+void WriteBehindStorage::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_)
+    {
+        if (interval_.count() <= 0)
+        {
+            // synchronous mode, wait to be re-enabled
+            condition_.wait(lock, [this]() { return stop_ || interval_.count() > 0; });
+            continue;
+        }
+
+        condition_.wait_for(lock, interval_,
+            [this]()
+            {
+                return stop_ || (threshold_ > 0 && pending_.size() >= threshold_);
+            });
+        if (stop_) break;
+        if (pending_.empty()) continue;
+
+        lock.unlock();
+        bool failed = false;
+        try
+        {
+            write();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> errorLock(mutex_);
+            error_ = std::current_exception();
+            failed = true;
+        }
+        lock.lock();
+
+        // the failed batch is pending again, don't retry before the interval
+        // even if it is above the threshold
+        if (failed) condition_.wait_for(lock, interval_, [this]() { return stop_; });
+    }
+}
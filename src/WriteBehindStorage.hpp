@@ -0,0 +1,93 @@
+#ifndef SEMPRPY_WRITEBEHINDSTORAGE_HPP_
+#define SEMPRPY_WRITEBEHINDSTORAGE_HPP_
+
+#include <sempr/DBConnection.hpp>
+#include <sempr/Entity.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+    A DBConnection that forwards to another one -- either directly, or, in
+    write-behind mode, by coalescing saves and removals per entity in memory
+    and handing them to the wrapped connection from a background thread. A
+    flush is triggered every interval, as soon as threshold entities are
+    pending, by flush() and on destruction.
+
+    The wrapped connection is always called with the sempr mutex held, as
+    writing an entity reads its components.
+*/
+class WriteBehindStorage : public sempr::DBConnection {
+public:
+    using Ptr = std::shared_ptr<WriteBehindStorage>;
+
+    WriteBehindStorage(sempr::DBConnection::Ptr storage);
+    ~WriteBehindStorage();
+
+    /**
+        Enables write-behind with the given flush interval (in seconds) and
+        threshold of pending entities. An interval <= 0 writes synchronously
+        again, after flushing everything that is pending.
+    */
+    void setWriteBehind(double interval, size_t threshold);
+
+    bool writeBehind() const;
+
+    /**
+        Writes everything that is pending. Rethrows the error of a failed
+        background flush, if any.
+    */
+    void flush();
+
+    size_t pending() const;
+
+    /**
+        Stops the background thread and writes everything that is pending.
+        Later operations are written synchronously. Only the first call has
+        an effect. Called on destruction,
+        but should be called earlier to be able to report errors and to not
+        block on the sempr mutex while holding the GIL.
+    */
+    void close();
+
+    std::vector<sempr::Entity::Ptr> loadAll() const override;
+    void save(std::vector<sempr::Entity::Ptr>& entities) override;
+    void remove(std::vector<sempr::Entity::Ptr>& entities) override;
+    void save(sempr::Entity::Ptr entity) override;
+    void remove(sempr::Entity::Ptr entity) override;
+
+private:
+    struct Pending {
+        sempr::Entity::Ptr entity;
+        bool removed;
+    };
+
+    sempr::DBConnection::Ptr storage_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    std::unordered_map<const sempr::Entity*, Pending> pending_;
+    std::chrono::duration<double> interval_{0};
+    size_t threshold_ = 0;
+    bool stop_ = false;
+    bool closed_ = false;
+    std::exception_ptr error_;
+    std::thread flusher_;
+
+    void enqueue(sempr::Entity::Ptr entity, bool removed);
+    /**
+        Takes everything pending and writes it, all with the sempr mutex
+        held. A batch that fails is pending again. Must not hold mutex_.
+    */
+    void write();
+    void run();
+};
+
+
+#endif /* include guard: SEMPRPY_WRITEBEHINDSTORAGE_HPP_ */
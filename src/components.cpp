@@ -2,30 +2,194 @@
 #include <pybind11/stl.h>
 #include <pybind11/eigen.h>
 #include <pybind11/operators.h>
+#include <pybind11/numpy.h>
 
 #include <sempr/component/AffineTransform.hpp>
 #include <sempr/component/GeosGeometry.hpp>
 #include <geos/geom/Point.h>
+#include <geos/version.h>
 #include <sempr/component/TripleVector.hpp>
 #include <sempr/component/TriplePropertyMap.hpp>
 
+#include <algorithm>
+#include <memory>
+#include <set>
 #include <stdexcept>
 
+#include "Threading.hpp"
+#include "GeosConversion.hpp"
+#include "BinarySerialization.hpp"
+#include "TermDictionary.hpp"
+#include "SpatialIndex.hpp"
+
 namespace py = pybind11;
 using namespace sempr;
 
+
+// Components that have been modified through the bindings since they were
+// last propagated, for changed(onlyIfModified=True). This is tracked per
+// component only: sempr re-extracts all triples of a component on every
+// change, so a per-triple diff would need support in sempr-core. Held as weak
+// references, so the mark of a destroyed component cannot carry over to a new
+// one at the same address. Only accessed with the GIL held.
+using WeakComponents = std::set<std::weak_ptr<Component>, std::owner_less<std::weak_ptr<Component>>>;
+
+WeakComponents& dirtyComponents()
+{
+    static WeakComponents dirty;
+    return dirty;
+}
+
+void markDirty(const std::shared_ptr<Component>& c)
+{
+    auto& dirty = dirtyComponents();
+    if (!dirty.insert(c).second) return;
+
+    // drop the marks of destroyed components from time to time
+    static size_t sweepAt = 1024;
+    if (dirty.size() < sweepAt) return;
+    for (auto it = dirty.begin(); it != dirty.end();)
+    {
+        if (it->expired()) it = dirty.erase(it);
+        else ++it;
+    }
+    sweepAt = 2 * std::max<size_t>(dirty.size(), 512);
+}
+
+bool takeDirty(const std::shared_ptr<Component>& c)
+{
+    return dirtyComponents().erase(c) > 0;
+}
+
+// propagates a change, if onlyIfModified only if the component has been
+// modified through the bindings
+template <class C>
+void changedIfModified(std::shared_ptr<C> c, bool onlyIfModified)
+{
+    bool modified = takeDirty(c);
+    if (modified || !onlyIfModified)
+    {
+        CoreLock lock;
+        c->changed();
+    }
+}
+
+
+// pickle support through the binary serialization
+template <class C>
+auto componentPickle()
+{
+    return py::pickle(
+        [](const C& c)
+        {
+            std::string bytes;
+            {
+                CoreLock lock;
+                bytes = componentToBytes(c);
+            }
+            return py::bytes(bytes);
+        },
+        [](const py::bytes& state)
+        {
+            auto c = std::dynamic_pointer_cast<C>(createComponentFromBytes(state));
+            if (!c) throw std::invalid_argument("binary data is of a different component type");
+            return c;
+        }
+    );
+}
+
+
+// converts a sempr.Triple or any sequence of 3 strings
+Triple toTriple(py::handle item)
+{
+    if (py::isinstance<Triple>(item)) return item.cast<Triple>();
+
+    if (!py::isinstance<py::sequence>(item) || py::isinstance<py::str>(item))
+        throw py::type_error("expected a Triple or a sequence of subject, predicate, object");
+
+    auto seq = py::reinterpret_borrow<py::sequence>(item);
+    if (seq.size() != 3)
+        throw std::invalid_argument("need subject, predicate, object");
+
+    return Triple(py::str(seq[0]), py::str(seq[1]), py::str(seq[2]));
+}
+
+std::vector<Triple> toTriples(py::iterable items)
+{
+    std::vector<Triple> triples;
+    if (py::hasattr(items, "__len__")) triples.reserve(py::len(items));
+
+    for (auto item : items)
+    {
+        triples.push_back(toTriple(item));
+    }
+    return triples;
+}
+
+std::vector<Triple> toTriples(const std::vector<std::string>& subjects,
+                              const std::vector<std::string>& predicates,
+                              const std::vector<std::string>& objects)
+{
+    if (subjects.size() != predicates.size() || subjects.size() != objects.size())
+        throw std::invalid_argument("subjects, predicates and objects differ in length");
+
+    std::vector<Triple> triples;
+    triples.reserve(subjects.size());
+    for (size_t i = 0; i < subjects.size(); i++)
+    {
+        triples.emplace_back(subjects[i], predicates[i], objects[i]);
+    }
+    return triples;
+}
+
+
 void initComponents(py::module_& m)
 {
+    // term dictionary
+    using Handle = TermDictionary::Handle;
+    auto terms = m.def_submodule("terms",
+        "Interned terms of triples. Triples return the same str object for "
+        "equal URIs and explicitly interned literals, and can be read and "
+        "created from integer handles of the terms.");
+    terms.def("intern", [](const std::string& term) { return TermDictionary::instance().intern(term); },
+        "The handle of the term, interning it if necessary.");
+    terms.def("handle",
+        [](const std::string& term) -> py::object
+        {
+            Handle handle;
+            if (TermDictionary::instance().find(term, handle)) return py::int_(handle);
+            return py::none();
+        },
+        "The handle of the term, or None if it is not interned.");
+    terms.def("term", [](Handle handle) { return TermDictionary::instance().str(handle); },
+        "The term of the handle.");
+    terms.def("size", []() { return TermDictionary::instance().size(); });
+    terms.def("limit", []() { return TermDictionary::instance().limit(); });
+    terms.def("setLimit", [](size_t limit) { TermDictionary::instance().setLimit(limit); },
+        "Number of terms after which the triple getters stop interning new "
+        "URIs (default: 1000000), as interned terms are never released.");
+
     // sempr::Component
     py::class_<Component, std::shared_ptr<Component>>(m, "Component")
         .def(py::init<>())
-        .def("changed", &Component::changed)
+        .def("changed",
+            [](Component& c)
+            {
+                c.changed();
+                SpatialIndex::geometryChanged(&c);
+            },
+            py::call_guard<CoreLock>()
+        )
         .def("fromJSON",
-            [](Component& c, const std::string& json)
+            [](std::shared_ptr<Component> c, const std::string& json)
             {
+                markDirty(c);
+
                 std::stringstream ss(json);
                 cereal::JSONInputArchive ar(ss);
-                c.loadFromJSON(ar);
+                CoreLock lock;
+                c->loadFromJSON(ar);
+                SpatialIndex::geometryChanged(c.get());
             }
         )
         .def("toJSON",
@@ -37,13 +201,40 @@ void initComponents(py::module_& m)
                     c.saveToJSON(ar);
                 }
                 return ss.str();
-            }
+            },
+            py::call_guard<CoreLock>()
+        )
+        .def("fromBytes",
+            [](std::shared_ptr<Component> c, const std::string& bytes)
+            {
+                markDirty(c);
+
+                CoreLock lock;
+                componentFromBytes(*c, bytes);
+                SpatialIndex::geometryChanged(c.get());
+            },
+            "Loads the component from the output of toBytes(). The data must "
+            "be of the same component type."
+        )
+        .def("toBytes",
+            [](const Component& c)
+            {
+                std::string bytes;
+                {
+                    CoreLock lock;
+                    bytes = componentToBytes(c);
+                }
+                return py::bytes(bytes);
+            },
+            "Serializes the component into a compact, portable binary format."
         )
+        .def(componentPickle<Component>())
     ;
 
     // AffineTransform
     py::class_<AffineTransform, std::shared_ptr<AffineTransform>, Component>(m, "AffineTransform")
         .def(py::init<>())
+        .def(componentPickle<AffineTransform>())
         .def(py::init(
             [](const Eigen::Matrix4d& mat)
             {
@@ -52,20 +243,53 @@ void initComponents(py::module_& m)
             }
         ))
         .def_property("transform",
-            [](const AffineTransform& a)
-            {
-                auto t = a.transform();
-                return t.matrix();
-            },
+            py::cpp_function(
+                [](const AffineTransform& a) -> Eigen::Matrix4d
+                {
+                    auto t = a.transform();
+                    return t.matrix();
+                },
+                py::call_guard<CoreLock>()
+            ),
             [](AffineTransform& a, const Eigen::Matrix4d& mat)
             {
                 Eigen::Affine3d affine(mat);
+
+                CoreLock lock;
                 a.setTransform(affine);
             }
-        );
+        )
+        .def("apply",
+            [](const AffineTransform& a, py::array_t<double, py::array::c_style> points)
+            {
+                if (points.ndim() != 2 || points.shape(1) != 3)
+                    throw std::invalid_argument("points must be a C-contiguous float64 array of shape (N, 3)");
+
+                using Points = Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>;
+                Eigen::Map<Points> p(points.mutable_data(), points.shape(0), 3);
+
+                Eigen::Affine3d t;
+                {
+                    CoreLock lock;
+                    t = a.transform();
+                }
+                {
+                    py::gil_scoped_release release;
+                    p = (p * t.linear().transpose()).rowwise() + t.translation().transpose();
+                }
+
+                return points;
+            },
+            py::arg("points").noconvert(),
+            "Transforms a C-contiguous (N, 3) float64 array of points in "
+            "place, and returns it. Other arrays are rejected, as they could "
+            "only be transformed in a copy."
+        )
+    ;
 
     // GeosGeometry
     py::class_<GeosGeometry, std::shared_ptr<GeosGeometry>, Component>(m, "GeosGeometry")
+        .def(componentPickle<GeosGeometry>())
         .def(py::init(
             []() // empty point by default
             {
@@ -73,36 +297,148 @@ void initComponents(py::module_& m)
                 return std::make_shared<GeosGeometry>(factory->createPoint());
             }
         ))
+        // before the WKT constructor, which would accept bytes, too
+        .def(py::init(
+            [](const py::bytes& wkb)
+            {
+                return std::make_shared<GeosGeometry>(readWKB(wkb));
+            }),
+            "Creates a geometry from WKB bytes."
+        )
         .def(py::init(
             [](const std::string& wkt)
             {
-                auto& factory = *geos::geom::GeometryFactory::getDefaultInstance();
-                geos::io::WKTReader reader(factory);
-
-                // parse the string
-                std::unique_ptr<geos::geom::Geometry> g(reader.read(wkt));
-                return std::make_shared<GeosGeometry>(std::move(g));
+                return std::make_shared<GeosGeometry>(readWKT(wkt));
             }
         ))
+        .def_static("fromCoordinates",
+            [](py::array_t<double, py::array::c_style | py::array::forcecast> coords, const std::string& type)
+            {
+                return std::make_shared<GeosGeometry>(fromCoordinateArray(coords, type));
+            },
+            py::arg("coordinates"), py::arg("type") = "LineString",
+            "Creates a Point, LineString, LinearRing, Polygon or MultiPoint "
+            "from a (N, 2) or (N, 3) array of coordinates."
+        )
         .def_property("geometry",
+            py::cpp_function(
+                [](const GeosGeometry& geo)
+                {
+                    geos::io::WKTWriter writer;
+                    int dim = geo.geometry()->getCoordinateDimension();
+                    writer.setOutputDimension(dim);
+
+                    // create the wkt string
+                    return writer.writeFormatted(geo.geometry());
+                },
+                py::call_guard<CoreLock>()
+            ),
+            [](GeosGeometry& geo, const std::string& wkt)
+            {
+                auto geometry = readWKT(wkt);
+
+                CoreLock lock;
+                geo.setGeometry(std::move(geometry));
+                SpatialIndex::geometryChanged(&geo);
+            }
+        )
+        .def_property("wkb",
             [](const GeosGeometry& geo)
             {
-                geos::io::WKTWriter writer;
-                int dim = geo.geometry()->getCoordinateDimension();
-                writer.setOutputDimension(dim);
+                std::string wkb;
+                {
+                    CoreLock lock;
+                    wkb = writeWKB(*geo.geometry());
+                }
+                return py::bytes(wkb);
+            },
+            [](GeosGeometry& geo, const py::bytes& wkb)
+            {
+                auto geometry = readWKB(wkb);
 
-                // create the wkt string
-                return writer.writeFormatted(geo.geometry());
+                CoreLock lock;
+                geo.setGeometry(std::move(geometry));
+                SpatialIndex::geometryChanged(&geo);
             },
-            [](GeosGeometry& geo, const std::string& wkt)
+            "The geometry as WKB bytes."
+        )
+        .def_property("coordinates",
+            [](const GeosGeometry& geo)
+            {
+                // the array is created from a copy, with the GIL held
+                std::unique_ptr<geos::geom::Geometry> clone;
+                {
+                    CoreLock lock;
+                    clone = std::unique_ptr<geos::geom::Geometry>(geo.geometry()->clone());
+                }
+                return toCoordinateArray(*clone);
+            },
+            [](GeosGeometry& geo, py::array_t<double, py::array::c_style | py::array::forcecast> coords)
             {
-                auto& factory = *geos::geom::GeometryFactory::getDefaultInstance();
-                geos::io::WKTReader reader(factory);
+                auto polygon = dynamic_cast<const geos::geom::Polygon*>(geo.geometry());
+                if (polygon && polygon->getNumInteriorRing() > 0)
+                    throw std::invalid_argument("cannot assign the coordinates of a Polygon with holes");
 
-                // parse the string
-                std::unique_ptr<geos::geom::Geometry> g(reader.read(wkt));
-                geo.setGeometry(std::move(g));
-            }
+                auto geometry = fromCoordinateArray(coords, geo.geometry()->getGeometryType());
+
+                CoreLock lock;
+                geo.setGeometry(std::move(geometry));
+                SpatialIndex::geometryChanged(&geo);
+            },
+            "Copy of the coordinates as a (N, 2) or (N, 3) array. Assigning "
+            "an array replaces the geometry by one of the same type, which is "
+            "not supported for Polygons with holes."
+        )
+        .def("coordinatesView",
+            [](const GeosGeometry& geo)
+            {
+                using geos::geom::Geometry;
+
+                // the view owns a clone, as the setters free the geometry
+                std::unique_ptr<Geometry> clone;
+                {
+                    CoreLock lock;
+                    clone = std::unique_ptr<Geometry>(geo.geometry()->clone());
+                }
+
+                const geos::geom::CoordinateSequence* seq = nullptr;
+                if (auto line = dynamic_cast<const geos::geom::LineString*>(clone.get()))
+                    seq = line->getCoordinatesRO();
+                else if (auto point = dynamic_cast<const geos::geom::Point*>(clone.get()))
+                    seq = point->getCoordinatesRO();
+                else
+                    throw py::type_error("coordinate views are only available for Points, LineStrings and LinearRings");
+
+                if (seq->isEmpty()) return py::array_t<double>(std::vector<size_t>{ 0, 3 });
+
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 12)
+                // packed doubles, 2 to 4 per coordinate
+                const size_t dim = seq->hasZ() ? 3 : 2;
+                const size_t stride = seq->stride() * sizeof(double);
+                const double* data = seq->data();
+#else
+                // an array of geos::geom::Coordinate, (x, y, z)
+                const size_t dim = 3;
+                const size_t stride = sizeof(geos::geom::Coordinate);
+                const double* data = &seq->getAt(0).x;
+#endif
+
+                auto owner = clone.release();
+                py::capsule base(owner, [](void* g) { delete static_cast<Geometry*>(g); });
+
+                py::array_t<double> view(
+                    std::vector<size_t>{ seq->getSize(), dim },
+                    std::vector<size_t>{ stride, sizeof(double) },
+                    data,
+                    base
+                );
+                view.attr("setflags")(py::arg("write") = false);
+                return view;
+            },
+            "Read-only (N, 2) or (N, 3) view of the coordinates of a Point, "
+            "LineString or LinearRing. The view refers to a snapshot of the "
+            "geometry that it owns, so it stays valid when the geometry of "
+            "the component is replaced, but does not follow the change."
         )
     ;
 
@@ -122,26 +458,46 @@ void initComponents(py::module_& m)
         .def("__str__", &Triple::toString)
         .def(py::self == py::self)
         .def_property("subject",
-            [](const Triple& t){ return t.getField(Triple::Field::SUBJECT);},
+            [](const Triple& t){ return TermDictionary::instance().str(t.getField(Triple::Field::SUBJECT));},
             [](Triple& t, const std::string& str){ t.setField(Triple::Field::SUBJECT, str);}
         )
         .def_property("predicate",
-            [](const Triple& t){ return t.getField(Triple::Field::PREDICATE);},
+            [](const Triple& t){ return TermDictionary::instance().str(t.getField(Triple::Field::PREDICATE));},
             [](Triple& t, const std::string& str){ t.setField(Triple::Field::PREDICATE, str);}
         )
         .def_property("object",
-            [](const Triple& t){ return t.getField(Triple::Field::OBJECT);},
+            [](const Triple& t){ return TermDictionary::instance().str(t.getField(Triple::Field::OBJECT));},
             [](Triple& t, const std::string& str){ t.setField(Triple::Field::OBJECT, str);}
         )
         .def("__getitem__",
             [](const Triple& t, size_t index)
             {
-                if (index == 0) return t.getField(Triple::Field::SUBJECT);
-                if (index == 1) return t.getField(Triple::Field::PREDICATE);
-                if (index == 2) return t.getField(Triple::Field::OBJECT);
+                auto& terms = TermDictionary::instance();
+                if (index == 0) return terms.str(t.getField(Triple::Field::SUBJECT));
+                if (index == 1) return terms.str(t.getField(Triple::Field::PREDICATE));
+                if (index == 2) return terms.str(t.getField(Triple::Field::OBJECT));
                 throw py::index_error();
             }
         )
+        .def_property_readonly("handles",
+            [](const Triple& t)
+            {
+                auto& terms = TermDictionary::instance();
+                return py::make_tuple(
+                    terms.intern(t.getField(Triple::Field::SUBJECT)),
+                    terms.intern(t.getField(Triple::Field::PREDICATE)),
+                    terms.intern(t.getField(Triple::Field::OBJECT)));
+            },
+            "(subject, predicate, object) as handles of the terms module."
+        )
+        .def_static("fromHandles",
+            [](Handle s, Handle p, Handle o)
+            {
+                auto& terms = TermDictionary::instance();
+                return Triple(terms.term(s), terms.term(p), terms.term(o));
+            },
+            "Creates a triple from handles of the terms module."
+        )
         .def("__setitem__",
             [](Triple& t, size_t index, const std::string& value)
             {
@@ -158,27 +514,163 @@ void initComponents(py::module_& m)
     // TripleVector
     py::class_<TripleVector, std::shared_ptr<TripleVector>, Component>(m, "TripleVector")
         .def(py::init<>())
+        .def(componentPickle<TripleVector>())
+        .def(py::init(
+            [](py::iterable triples)
+            {
+                auto tv = std::make_shared<TripleVector>();
+                for (auto& t : toTriples(triples)) tv->addTriple(t);
+                return tv;
+            }),
+            "Creates a TripleVector from Triples or (s, p, o) tuples."
+        )
+        .def(py::init(
+            [](const std::vector<std::string>& subjects,
+               const std::vector<std::string>& predicates,
+               const std::vector<std::string>& objects)
+            {
+                auto tv = std::make_shared<TripleVector>();
+                for (auto& t : toTriples(subjects, predicates, objects)) tv->addTriple(t);
+                return tv;
+            }),
+            "Creates a TripleVector from three parallel sequences of strings."
+        )
         .def("triples",
             [](const TripleVector& tv)
             {
                 std::vector<Triple> l;
                 tv.getTriples(l);
                 return l;
+            },
+            py::call_guard<CoreLock>()
+        )
+        .def("__getitem__", &TripleVector::getTripleAt, py::call_guard<CoreLock>())
+        .def("__delitem__",
+            [](std::shared_ptr<TripleVector> tv, size_t index)
+            {
+                {
+                    CoreLock lock;
+                    tv->removeTripleAt(index);
+                }
+                markDirty(tv);
             }
         )
-        .def("__getitem__", &TripleVector::getTripleAt)
-        .def("__delitem__", &TripleVector::removeTripleAt)
-        .def("__len__", &TripleVector::size)
+        .def("__len__", &TripleVector::size, py::call_guard<CoreLock>())
+        .def("handles",
+            [](const TripleVector& tv)
+            {
+                std::vector<Triple> triples;
+                {
+                    CoreLock lock;
+                    tv.getTriples(triples);
+                }
+
+                auto& terms = TermDictionary::instance();
+                py::array_t<Handle> handles(std::vector<size_t>{ triples.size(), 3 });
+                auto h = handles.mutable_unchecked<2>();
+                for (size_t i = 0; i < triples.size(); i++)
+                {
+                    h(i, 0) = terms.intern(triples[i].getField(Triple::Field::SUBJECT));
+                    h(i, 1) = terms.intern(triples[i].getField(Triple::Field::PREDICATE));
+                    h(i, 2) = terms.intern(triples[i].getField(Triple::Field::OBJECT));
+                }
+                return handles;
+            },
+            "The triples as a (N, 3) array of handles of the terms module."
+        )
+        .def("extendHandles",
+            [](std::shared_ptr<TripleVector> tv, py::array_t<Handle, py::array::c_style | py::array::forcecast> handles)
+            {
+                if (handles.ndim() != 2 || handles.shape(1) != 3)
+                    throw std::invalid_argument("handles must be of shape (N, 3)");
+
+                auto& terms = TermDictionary::instance();
+                auto h = handles.unchecked<2>();
+                std::vector<Triple> converted;
+                converted.reserve(h.shape(0));
+                for (py::ssize_t i = 0; i < h.shape(0); i++)
+                {
+                    converted.emplace_back(terms.term(h(i, 0)), terms.term(h(i, 1)), terms.term(h(i, 2)));
+                }
+                markDirty(tv);
+
+                CoreLock lock;
+                for (auto& t : converted) tv->addTriple(t);
+            },
+            "Adds the triples of a (N, 3) array of handles of the terms "
+            "module, see extend."
+        )
+        // iterates over a copy, the vector may change in between
         .def("__iter__",
             [](const TripleVector& v)
             {
-                return py::make_iterator(v.begin(), v.end());
+                std::vector<Triple> l;
+                {
+                    CoreLock lock;
+                    v.getTriples(l);
+                }
+                return py::iter(py::cast(std::move(l)));
+            }
+        )
+        .def("add",
+            [](std::shared_ptr<TripleVector> tv, const Triple& t)
+            {
+                markDirty(tv);
+
+                CoreLock lock;
+                tv->addTriple(t);
+            }
+        )
+        .def("extend",
+            [](std::shared_ptr<TripleVector> tv, py::iterable triples)
+            {
+                auto converted = toTriples(triples);
+                markDirty(tv);
+
+                CoreLock lock;
+                for (auto& t : converted) tv->addTriple(t);
+            },
+            "Adds all Triples or (s, p, o) tuples of the iterable. Call "
+            "changed() once afterwards to propagate the whole batch."
+        )
+        .def("extend",
+            [](std::shared_ptr<TripleVector> tv,
+               const std::vector<std::string>& subjects,
+               const std::vector<std::string>& predicates,
+               const std::vector<std::string>& objects)
+            {
+                auto converted = toTriples(subjects, predicates, objects);
+                markDirty(tv);
+
+                CoreLock lock;
+                for (auto& t : converted) tv->addTriple(t);
             },
-            py::keep_alive<0, 1>()
+            "Adds the triples given as three parallel sequences of strings."
+        )
+        .def("remove",
+            [](std::shared_ptr<TripleVector> tv, const Triple& t)
+            {
+                markDirty(tv);
+
+                CoreLock lock;
+                tv->removeTriple(t);
+            }
+        )
+        .def("clear",
+            [](std::shared_ptr<TripleVector> tv)
+            {
+                markDirty(tv);
+
+                CoreLock lock;
+                tv->clear();
+            }
+        )
+        .def("changed", &changedIfModified<TripleVector>, py::arg("onlyIfModified") = false,
+            "Propagates the triples, all of them are retracted and asserted "
+            "again. With onlyIfModified, only if they have been modified "
+            "through add, extend, remove, clear etc. since the last call -- "
+            "in-place changes of the triples are not tracked."
         )
-        .def("add", &TripleVector::addTriple)
-        .def("remove", &TripleVector::removeTriple)
-        .def("clear", &TripleVector::clear)
     ;
 
 
@@ -195,10 +687,15 @@ void initComponents(py::module_& m)
     // TriplePropertyMap
     py::class_<TriplePropertyMap, std::shared_ptr<TriplePropertyMap>, Component>(m, "TriplePropertyMap")
         .def(py::init<>())
+        .def(componentPickle<TriplePropertyMap>())
         .def("__getitem__",
             [](TriplePropertyMap& m, const std::string& key)
             {
-                auto& entry = m.map_.at(key);
+                auto entry = [&]()
+                {
+                    CoreLock lock;
+                    return m.map_.at(key);
+                }();
 
                 py::object val;
                 switch (entry.type()) {
@@ -220,54 +717,123 @@ void initComponents(py::module_& m)
             }
         )
         .def("__delitem__",
-            [](TriplePropertyMap& m, const std::string& key)
+            [](std::shared_ptr<TriplePropertyMap> m, const std::string& key)
             {
-                m.map_.erase(key);
+                bool erased;
+                {
+                    CoreLock lock;
+                    erased = m->map_.erase(key) > 0;
+                }
+                if (erased) markDirty(m);
             }
         )
+        // assignments of the value that is already set don't mark the map
+        // as modified
         .def("__setitem__",
-            [](TriplePropertyMap& m, const std::string& key, int val)
+            [](std::shared_ptr<TriplePropertyMap> m, const std::string& key, int val)
             {
-                m.map_[key] = val;
+                bool modified = [&]()
+                {
+                    CoreLock lock;
+                    auto it = m->map_.find(key);
+                    if (it != m->map_.end() &&
+                        it->second.type() == TriplePropertyMapEntry::INT &&
+                        static_cast<int>(it->second) == val) return false;
+
+                    m->map_[key] = val;
+                    return true;
+                }();
+                if (modified) markDirty(m);
             }
         )
         .def("__setitem__",
-            [](TriplePropertyMap& m, const std::string& key, float val)
+            [](std::shared_ptr<TriplePropertyMap> m, const std::string& key, float val)
             {
-                m.map_[key] = val;
+                bool modified = [&]()
+                {
+                    CoreLock lock;
+                    auto it = m->map_.find(key);
+                    if (it != m->map_.end() &&
+                        it->second.type() == TriplePropertyMapEntry::FLOAT &&
+                        static_cast<float>(it->second) == val) return false;
+
+                    m->map_[key] = val;
+                    return true;
+                }();
+                if (modified) markDirty(m);
             }
         )
         .def("__setitem__",
-            [](TriplePropertyMap& m, const std::string& key, const std::pair<std::string, bool>& val)
+            [](std::shared_ptr<TriplePropertyMap> m, const std::string& key, const std::pair<std::string, bool>& val)
             {
-                m.map_[key] = { val.first, val.second };
+                bool modified = [&]()
+                {
+                    CoreLock lock;
+                    auto type = val.second ? TriplePropertyMapEntry::RESOURCE : TriplePropertyMapEntry::STRING;
+                    auto it = m->map_.find(key);
+                    if (it != m->map_.end() &&
+                        it->second.type() == type &&
+                        static_cast<std::string>(it->second) == val.first) return false;
+
+                    m->map_[key] = { val.first, val.second };
+                    return true;
+                }();
+                if (modified) markDirty(m);
             }
         )
         .def("__setitem__",
-            [](TriplePropertyMap& m, const std::string& key, const std::string& val)
+            [](std::shared_ptr<TriplePropertyMap> m, const std::string& key, const std::string& val)
             {
-                m.map_[key] = val;
+                bool modified = [&]()
+                {
+                    CoreLock lock;
+                    auto it = m->map_.find(key);
+                    if (it != m->map_.end() &&
+                        it->second.type() == TriplePropertyMapEntry::STRING &&
+                        static_cast<std::string>(it->second) == val) return false;
+
+                    m->map_[key] = val;
+                    return true;
+                }();
+                if (modified) markDirty(m);
             }
         )
+        .def("changed", &changedIfModified<TriplePropertyMap>, py::arg("onlyIfModified") = false,
+            "Propagates the properties, all of them are retracted and asserted "
+            "again. With onlyIfModified, only if they have been modified "
+            "through the bindings since the last call."
+        )
+        // both iterate over copies, the map may change in between
         .def("__iter__",
             [](TriplePropertyMap& m)
             {
-                return py::make_key_iterator(m.map_.begin(), m.map_.end());
-            },
-            py::keep_alive<0, 1>()
+                std::vector<std::string> keys;
+                {
+                    CoreLock lock;
+                    keys.reserve(m.map_.size());
+                    for (auto& entry : m.map_) keys.push_back(entry.first);
+                }
+                return py::iter(py::cast(std::move(keys)));
+            }
         )
         .def("iter_triples",
             [](TriplePropertyMap& m)
             {
-                return py::make_iterator(m.begin(), m.end());
-            },
-            py::keep_alive<0, 1>()
+                std::vector<Triple> l;
+                {
+                    CoreLock lock;
+                    for (auto it = m.begin(); !(it == m.end()); ++it) l.push_back(*it);
+                }
+                return py::iter(py::cast(std::move(l)));
+            }
         )
         .def("typeAt",
             [](TriplePropertyMap& m, const std::string& key)
             {
-                return m.map_[key].type();
-            }
+                auto it = m.map_.find(key);
+                return it == m.map_.end() ? TriplePropertyMapEntry::INVALID : it->second.type();
+            },
+            py::call_guard<CoreLock>()
         )
     ;
 }
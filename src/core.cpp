@@ -2,12 +2,17 @@
 #include <pybind11/stl.h>
 #include <pybind11/functional.h>
 #include <pybind11/embed.h>
+#include <pybind11/numpy.h>
 
 #include <sempr/Core.hpp>
 #include <sempr/plugins/RDFPlugin.hpp>
 #include <sempr/SeparateFileStorage.hpp>
 #include <sempr/RDF.hpp>
 #include <sempr/component/TripleContainer.hpp>
+#include <sempr/component/AffineTransform.hpp>
+#include <sempr/component/GeosGeometry.hpp>
+#include <sempr/component/TripleVector.hpp>
+#include <sempr/component/TriplePropertyMap.hpp>
 #include <sempr/ECWMEToJSONConverter.hpp>
 #include <sempr/TupleWMEToJSONConverter.hpp>
 #include <sempr/TupleGeoToJSONConverter.hpp>
@@ -18,6 +23,22 @@
 #include <rete-reasoner/CallbackEffectBuilder.hpp>
 
 #include "external/pybind11_json.hpp"
+#include "PyCore.hpp"
+#include "Threading.hpp"
+#include "GeosConversion.hpp"
+#include "BinarySerialization.hpp"
+#include "ExplanationGraph.hpp"
+#include "Tracer.hpp"
+#include "MemoryUsage.hpp"
+#include "TermDictionary.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <regex>
+#include <unordered_map>
 
 namespace py = pybind11;
 using namespace sempr;
@@ -27,15 +48,437 @@ using namespace sempr;
 template <typename... Ts>
 using callback_t = std::function<void(rete::PropagationFlag, Ts...)>;
 
+// The callback is invoked during inference, when the GIL has been released.
 template <typename... Ts>
-callback_t<Ts...> makeCallback(py::object pycb)
+callback_t<Ts...> makeCallback(const std::string& name, py::object pycb)
 {
-    return [pycb](rete::PropagationFlag flag, Ts... args)
+    auto cb = gilSafe(pycb);
+    return [cb, name](rete::PropagationFlag flag, Ts... args)
     {
-        return pycb(flag, args...);
+        TraceSpan span("python", name.c_str());
+        py::gil_scoped_acquire gil;
+        (*cb)(flag, args...);
     };
 }
 
+// The batched variant only records the firing, the core hands all of them to
+// python after the inference run.
+template <typename... Ts>
+callback_t<Ts...> makeBatchedCallback(std::shared_ptr<CallbackBatch> batch)
+{
+    return [batch](rete::PropagationFlag flag, Ts... args)
+    {
+        batch->add(flag, std::move(args)...);
+    };
+}
+
+
+// type filters for the n-ary componentQuery
+using component_filter_t = std::function<bool(const Component::Ptr&)>;
+
+template <class C>
+component_filter_t makeComponentFilter()
+{
+    return [](const Component::Ptr& c)
+    {
+        return std::dynamic_pointer_cast<C>(c) != nullptr;
+    };
+}
+
+component_filter_t componentFilterFor(py::handle type)
+{
+    if (type.is_none() || type.is(py::type::of<Component>()))
+        return [](const Component::Ptr&) { return true; };
+    if (type.is(py::type::of<AffineTransform>())) return makeComponentFilter<AffineTransform>();
+    if (type.is(py::type::of<GeosGeometry>())) return makeComponentFilter<GeosGeometry>();
+    if (type.is(py::type::of<TripleVector>())) return makeComponentFilter<TripleVector>();
+    if (type.is(py::type::of<TriplePropertyMap>())) return makeComponentFilter<TriplePropertyMap>();
+
+    throw py::type_error("unsupported component type: " + py::repr(type).cast<std::string>());
+}
+
+
+// The variables projected by a SPARQL SELECT query, in order: the ?vars and
+// (... AS ?vars) of the projection, or for SELECT * all variables of the body
+// in order of appearance. IRIs, literals and comments are skipped.
+std::vector<std::string> projectedVariables(const std::string& query)
+{
+    std::vector<std::string> tokens;
+    size_t pos = 0;
+    while (pos < query.size())
+    {
+        const char c = query[pos];
+        if (std::isspace(static_cast<unsigned char>(c))) { pos++; continue; }
+
+        size_t end = pos + 1;
+        if (c == '<')
+        {
+            // an IRI, unless it is a comparison
+            size_t close = query.find_first_of("> \t\n", end);
+            if (close != std::string::npos && query[close] == '>') end = close + 1;
+        }
+        else if (c == '"' || c == '\'')
+        {
+            while (end < query.size() && query[end] != c) end += (query[end] == '\\' ? 2 : 1);
+            end = std::min(end + 1, query.size());
+            tokens.push_back("\"");
+            pos = end;
+            continue;
+        }
+        else if (c == '#')
+        {
+            end = query.find('\n', pos);
+            if (end == std::string::npos) end = query.size();
+            pos = end;
+            continue;
+        }
+        else if (c == '?' || c == '$' || std::isalnum(static_cast<unsigned char>(c)) || c == '_')
+        {
+            while (end < query.size() &&
+                   (std::isalnum(static_cast<unsigned char>(query[end])) || query[end] == '_' ||
+                    query[end] == ':' || query[end] == '-'))
+            {
+                end++;
+            }
+        }
+        tokens.push_back(query.substr(pos, end - pos));
+        pos = end;
+    }
+
+    auto upper = [](std::string str)
+    {
+        for (auto& c : str) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        return str;
+    };
+    auto isVar = [](const std::string& token)
+    {
+        return token.size() > 1 && (token[0] == '?' || token[0] == '$');
+    };
+
+    auto select = std::find_if(tokens.begin(), tokens.end(),
+                               [&](const std::string& t) { return upper(t) == "SELECT"; });
+
+    std::vector<std::string> vars;
+    auto add = [&](const std::string& var)
+    {
+        auto name = var.substr(1);
+        if (std::find(vars.begin(), vars.end(), name) == vars.end()) vars.push_back(name);
+    };
+
+    bool all = false;
+    int depth = 0;
+    auto it = (select == tokens.end() ? select : select + 1);
+    for (; it != tokens.end(); ++it)
+    {
+        if (*it == "{" || (depth == 0 && upper(*it) == "WHERE")) break;
+        if (*it == "(") depth++;
+        else if (*it == ")") depth--;
+        else if (*it == "*" && depth == 0) all = true;
+        else if (isVar(*it) && depth == 0) add(*it);
+        else if (upper(*it) == "AS" && it + 1 != tokens.end() && isVar(*(it + 1))) add(*++it);
+    }
+
+    if (all)
+    {
+        for (; it != tokens.end(); ++it)
+        {
+            if (isVar(*it)) add(*it);
+        }
+    }
+
+    return vars;
+}
+
+
+/**
+    Iterates the results of a SPARQL query in batches. The query is answered
+    once, on the first access, and its rows are held natively and only
+    converted to python batch by batch. The iteration is therefore a
+    consistent snapshot of the state at the first access, which is not
+    affected by later changes, and each row is visited exactly once.
+*/
+class SPARQLCursor {
+public:
+    using Row = decltype(SPARQLQuery::results)::value_type;
+
+    SPARQLCursor(PyCore& core, const std::string& query, size_t batchSize)
+        : core_(core), query_(query), batchSize_(batchSize)
+    {
+        if (batchSize_ == 0) throw std::invalid_argument("batch size must be positive");
+    }
+
+    Row next()
+    {
+        fetch();
+        if (pos_ == rows_.size()) throw py::stop_iteration();
+
+        return std::move(rows_[pos_++]);
+    }
+
+    std::vector<Row> nextBatch()
+    {
+        fetch();
+
+        const size_t end = std::min(rows_.size(), pos_ + batchSize_);
+        std::vector<Row> batch(std::make_move_iterator(rows_.begin() + pos_),
+                               std::make_move_iterator(rows_.begin() + end));
+        pos_ = end;
+        if (pos_ == rows_.size())
+        {
+            // exhausted, release the moved-from rows
+            rows_ = std::vector<Row>();
+            pos_ = 0;
+        }
+        return batch;
+    }
+
+private:
+    PyCore& core_;
+    std::string query_;
+    size_t batchSize_;
+
+    std::vector<Row> rows_;
+    size_t pos_ = 0;
+    bool fetched_ = false;
+
+    void fetch()
+    {
+        if (fetched_) return;
+
+        SPARQLQuery sq;
+        sq.query = query_;
+        {
+            CoreLock lock;
+            auto rdf = core_.getPlugin<RDFPlugin>();
+            if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
+
+            rdf->soprano().answer(sq);
+        }
+
+        rows_ = std::move(sq.results);
+        pos_ = 0;
+        fetched_ = true;
+    }
+};
+
+
+/**
+    A SPARQL query that is split into its constant parts and the parameters
+    of its body (everything after the first '{') once, so that it can be
+    executed repeatedly with the parameters replaced by values. Parameters
+    are written as $name, while ?name always remains a variable. All
+    parameters must be bound, and values are validated or escaped so they
+    can only form a single term:
+      - "<...>": an IRI, without whitespace or any of <>"{}|^`\ inside
+      - "prefix:name": a prefixed name
+      - other strings: a string literal, escaped and quoted
+      - int / float / bool: a typed literal
+*/
+class PreparedQuery {
+public:
+    using Bindings = std::unordered_map<std::string, std::string>;
+
+    PreparedQuery(PyCore& core, const std::string& query)
+        : core_(core), query_(query)
+    {
+        size_t pos = query.find('{');
+        if (pos == std::string::npos) pos = query.size();
+
+        std::string part = query.substr(0, pos);
+        while (pos < query.size())
+        {
+            const char c = query[pos];
+            if (c == '<')
+            {
+                // skip IRIs, which may contain '$', but not "<" in filters
+                size_t end = query.find_first_of("> \t\n", pos + 1);
+                if (end != std::string::npos && query[end] == '>')
+                {
+                    part.append(query, pos, end - pos + 1);
+                    pos = end + 1;
+                    continue;
+                }
+            }
+            else if (c == '"' || c == '\'')
+            {
+                // skip string literals
+                size_t end = pos + 1;
+                while (end < query.size() && query[end] != c)
+                {
+                    if (query[end] == '\\') end++;
+                    end++;
+                }
+                end = std::min(end, query.size() - 1);
+                part.append(query, pos, end - pos + 1);
+                pos = end + 1;
+                continue;
+            }
+            else if (c == '$')
+            {
+                size_t end = pos + 1;
+                while (end < query.size() && (std::isalnum(static_cast<unsigned char>(query[end])) || query[end] == '_'))
+                {
+                    end++;
+                }
+
+                if (end > pos + 1)
+                {
+                    parts_.push_back(std::move(part));
+                    part = std::string();
+                    vars_.push_back(query.substr(pos + 1, end - pos - 1));
+                    pos = end;
+                    continue;
+                }
+            }
+
+            part.push_back(c);
+            pos++;
+        }
+        parts_.push_back(std::move(part));
+    }
+
+    PyCore& core() const { return core_; }
+    const std::string& query() const { return query_; }
+    const std::vector<std::string>& parameters() const { return vars_; }
+
+    /** Assembles the query with all parameters replaced */
+    std::string bind(const Bindings& bindings) const
+    {
+        std::string result;
+        result.reserve(query_.size());
+
+        for (size_t i = 0; i < vars_.size(); i++)
+        {
+            result += parts_[i];
+
+            auto value = bindings.find(vars_[i]);
+            if (value == bindings.end()) throw py::key_error("unbound parameter: $" + vars_[i]);
+            result += value->second;
+        }
+        result += parts_.back();
+
+        return result;
+    }
+
+    /** Converts the keyword arguments into SPARQL terms */
+    Bindings toBindings(const py::kwargs& kwargs) const
+    {
+        Bindings bindings;
+        for (auto& item : kwargs)
+        {
+            std::string name = py::str(item.first);
+            if (std::find(vars_.begin(), vars_.end(), name) == vars_.end())
+                throw py::key_error("not a parameter of the query: " + name);
+
+            bindings[name] = toTerm(item.second);
+        }
+        return bindings;
+    }
+
+private:
+    PyCore& core_;
+    std::string query_;
+    std::vector<std::string> parts_;   // one more than vars_
+    std::vector<std::string> vars_;
+
+    static std::string toTerm(py::handle value)
+    {
+        // numbers are formatted from their values, subclasses may override
+        // __str__ and __repr__
+        if (py::isinstance<py::bool_>(value)) return value.cast<bool>() ? "true" : "false";
+        if (py::isinstance<py::int_>(value))
+        {
+            try
+            {
+                return std::to_string(value.cast<long long>());
+            }
+            catch (py::cast_error&)
+            {
+                throw std::overflow_error("integer parameter out of range");
+            }
+        }
+        if (py::isinstance<py::float_>(value))
+        {
+            double d = value.cast<double>();
+            std::string lexical;
+            if (std::isnan(d)) lexical = "NaN";
+            else if (std::isinf(d)) lexical = d > 0 ? "INF" : "-INF";
+            else
+            {
+                char buffer[32];
+                std::snprintf(buffer, sizeof(buffer), "%.17g", d);
+                lexical = buffer;
+            }
+            return "\"" + lexical + "\"^^<http://www.w3.org/2001/XMLSchema#double>";
+        }
+        if (!py::isinstance<py::str>(value))
+            throw py::type_error("parameter values must be str, int, float or bool");
+
+        std::string str = py::str(value);
+
+        if (!str.empty() && str.front() == '<')
+        {
+            static const std::regex iri(R"(<[^<>"{}|^`\\\x00-\x20]*>)");
+            if (!std::regex_match(str, iri)) throw std::invalid_argument("invalid IRI: " + str);
+            return str;
+        }
+
+        static const std::regex prefixedName(R"([A-Za-z][A-Za-z0-9_.-]*:[A-Za-z0-9_]([A-Za-z0-9_.-]*[A-Za-z0-9_-])?)");
+        if (std::regex_match(str, prefixedName)) return str;
+
+        std::string literal = "\"";
+        for (char c : str)
+        {
+            switch (c)
+            {
+                case '"':  literal += "\\\""; break;
+                case '\\': literal += "\\\\"; break;
+                case '\n': literal += "\\n"; break;
+                case '\r': literal += "\\r"; break;
+                case '\t': literal += "\\t"; break;
+                default:   literal += c;
+            }
+        }
+        return literal + "\"";
+    }
+};
+
+
+// the evidences of an entity change as soon as its components do
+void entityChanged(const Entity& entity)
+{
+    if (auto core = PyCore::of(entity)) core->stateChanged();
+}
+
+
+/**
+    Creates a core that persists to the given backend (wrapped to allow
+    write-behind) and adds all entities stored in it.
+*/
+std::unique_ptr<PyCore> createPersistentCore(IDGenerator::Ptr ids, DBConnection::Ptr db)
+{
+    auto storage = std::make_shared<WriteBehindStorage>(db);
+    auto core = std::make_unique<PyCore>(ids, storage);
+    core->setStorage(storage);
+
+    CoreLock lock;
+    TraceSpan span("persistence", "load entities");
+    auto start = std::chrono::steady_clock::now();
+    auto saved = db->loadAll();
+    for (auto e : saved)
+    {
+        core->addEntity(e);
+    }
+
+    LoadStats stats;
+    stats.entities = saved.size();
+    stats.threads = 1;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    core->setLoadStats(stats);
+
+    return core;
+}
+
 
 void initCore(py::module_& m)
 {
@@ -108,17 +551,45 @@ void initCore(py::module_& m)
         .def_property_readonly("idIsURI", &Entity::idIsURI)
         .def("setId", &Entity::setId)
         .def("setUri", &Entity::setURI)
-        .def_property_readonly("components", &Entity::getComponentsWithTag<Component>)
-        .def("addComponent", static_cast<void(Entity::*)(Component::Ptr)>(&Entity::addComponent))
-        .def("addComponent", static_cast<void(Entity::*)(Component::Ptr, const std::string&)>(&Entity::addComponent))
-        .def("removeComponent", &Entity::removeComponent)
+        .def_property_readonly("components",
+            py::cpp_function(&Entity::getComponentsWithTag<Component>, py::call_guard<CoreLock>()))
+        .def("addComponent",
+            [](Entity::Ptr self, Component::Ptr c)
+            {
+                self->addComponent(c);
+                SpatialIndex::componentAdded(self, c);
+                entityChanged(*self);
+            },
+            py::call_guard<CoreLock>()
+        )
+        .def("addComponent",
+            [](Entity::Ptr self, Component::Ptr c, const std::string& tag)
+            {
+                self->addComponent(c, tag);
+                SpatialIndex::componentAdded(self, c);
+                entityChanged(*self);
+            },
+            py::call_guard<CoreLock>()
+        )
+        .def("removeComponent",
+            [](Entity::Ptr self, Component::Ptr c)
+            {
+                self->removeComponent(c);
+                SpatialIndex::componentRemoved(self, c);
+                entityChanged(*self);
+            },
+            py::call_guard<CoreLock>()
+        )
         .def("fromJSON",
-            [](Entity& e, const std::string& json)
+            [](Entity::Ptr e, const std::string& json)
             {
                 std::stringstream ss(json);
                 cereal::JSONInputArchive ar(ss);
-                e.load(ar);
-            }
+                e->load(ar);
+                SpatialIndex::entityChanged(e);
+                entityChanged(*e);
+            },
+            py::call_guard<CoreLock>()
         )
         .def("toJSON",
             [](const Entity& e) -> std::string
@@ -129,8 +600,50 @@ void initCore(py::module_& m)
                     e.save(ar);
                 }
                 return ss.str();
-            }
+            },
+            py::call_guard<CoreLock>()
+        )
+        .def("fromBytes",
+            [](Entity::Ptr e, const std::string& bytes)
+            {
+                entityFromBytes(*e, bytes);
+                SpatialIndex::entityChanged(e);
+                entityChanged(*e);
+            },
+            py::call_guard<CoreLock>(),
+            "Loads the id and components of the entity from the output of "
+            "toBytes()."
+        )
+        .def("toBytes",
+            [](Entity& e)
+            {
+                std::string bytes;
+                {
+                    CoreLock lock;
+                    bytes = entityToBytes(e);
+                }
+                return py::bytes(bytes);
+            },
+            "Serializes the entity and its components into a compact, "
+            "portable binary format. Also used for pickling."
         )
+        .def(py::pickle(
+            [](Entity& e)
+            {
+                std::string bytes;
+                {
+                    CoreLock lock;
+                    bytes = entityToBytes(e);
+                }
+                return py::bytes(bytes);
+            },
+            [](const py::bytes& state)
+            {
+                auto e = Entity::create();
+                entityFromBytes(*e, state);
+                return e;
+            }
+        ))
     ;
 
     // SPARQLQuery result types
@@ -141,6 +654,71 @@ void initCore(py::module_& m)
         .value("RESOURCE", SPARQLQuery::ValueType::RESOURCE)
         .export_values();
 
+    py::class_<SPARQLCursor>(m, "SPARQLCursor")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", &SPARQLCursor::next)
+        .def("nextBatch", &SPARQLCursor::nextBatch,
+            "Returns up to batch_size rows, an empty list when exhausted.")
+    ;
+
+    py::class_<PreparedQuery>(m, "PreparedQuery")
+        .def_property_readonly("query", &PreparedQuery::query)
+        .def_property_readonly("parameters", &PreparedQuery::parameters)
+        .def("bind",
+            [](const PreparedQuery& self, py::kwargs kwargs)
+            {
+                return self.bind(self.toBindings(kwargs));
+            },
+            "Returns the query string with the parameters replaced by the "
+            "given values."
+        )
+        .def("execute",
+            [](const PreparedQuery& self, py::kwargs kwargs)
+            {
+                SPARQLQuery sq;
+                sq.query = self.bind(self.toBindings(kwargs));
+
+                CoreLock lock;
+                auto rdf = self.core().getPlugin<RDFPlugin>();
+                if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
+
+                rdf->soprano().answer(sq);
+                return sq.results;
+            },
+            "Executes the query, with the parameters replaced by the values "
+            "given as keyword arguments."
+        )
+        .def("componentQuery",
+            [](const PreparedQuery& self, const std::string& var, py::kwargs kwargs)
+            {
+                auto query = self.bind(self.toBindings(kwargs));
+
+                CoreLock lock;
+                auto rdf = self.core().getPlugin<RDFPlugin>();
+                if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
+
+                return rdf->componentQuery(query)
+                    .with<Component>(var).includeInferred(true).aggregate()
+                    .execute();
+            }
+        )
+        .def("componentQuery",
+            [](const PreparedQuery& self, const std::string& var0, const std::string& var1, py::kwargs kwargs)
+            {
+                auto query = self.bind(self.toBindings(kwargs));
+
+                CoreLock lock;
+                auto rdf = self.core().getPlugin<RDFPlugin>();
+                if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
+
+                return rdf->componentQuery(query)
+                    .with<Component>(var0).includeInferred(true).aggregate()
+                    .with<Component>(var1).includeInferred(true).aggregate()
+                    .execute();
+            }
+        )
+    ;
+
     // for component query results
     py::class_<ComponentQueryResult<Component>>(m, "ComponentQueryResult")
         .def_readonly("entity", &ComponentQueryResult<Component>::entity)
@@ -150,27 +728,120 @@ void initCore(py::module_& m)
 
 
     // sempr::Core
-    py::class_<Core>(m, "Core")
+    // All methods that touch the core release the GIL while they run. Python
+    // callback effects re-acquire it only when they actually fire.
+    py::class_<PyCore>(m, "Core")
         .def(py::init<>())
         .def(py::init(
             [](const std::string& path)
             {
                 if (!fs::exists(path)) fs::create_directory(path);
                 auto db = std::make_shared<SeparateFileStorage>(path);
-                auto core = std::make_unique<Core>(db, db);
-                auto saved = db->loadAll();
-                for (auto e : saved)
+                return createPersistentCore(db, db);
+            }), "Initializes a sempr::Core with a SeparateFileStorage "
+                "persistence module pointing to the given path."
+        )
+        .def(py::init(
+            [](const std::string& path, size_t threads, py::object progress)
+            {
+                if (!fs::exists(path)) fs::create_directory(path);
+                auto db = std::make_shared<SeparateFileStorage>(path);
+                auto ids = std::make_shared<ReservedIDs>(db);
+                auto storage = std::make_shared<WriteBehindStorage>(db);
+                auto core = std::make_unique<PyCore>(ids, storage);
+                core->setStorage(storage);
+                core->loadEntities(path, *ids, threads, progress);
+                return core;
+            }),
+            py::arg("path"), py::arg("threads"), py::arg("progress") = py::none(),
+            "Like Core(path), but parses the persisted entities on the given "
+            "number of threads (0: one per cpu core) and adds them in batches. "
+            "progress(loaded, total) is called after every batch."
+        )
+        .def(py::init(
+            [](const std::string& path, const std::string& backend)
+            {
+                if (backend == "files")
+                {
+                    if (!fs::exists(path)) fs::create_directory(path);
+                    auto db = std::make_shared<SeparateFileStorage>(path);
+                    return createPersistentCore(db, db);
+                }
+                else if (backend == "log")
                 {
-                    core->addEntity(e);
+                    auto log = std::make_shared<LogStorage>(path);
+                    auto core = createPersistentCore(log, log);
+                    core->setLogStorage(log);
+                    return core;
                 }
 
-                return core;
-            }), "Initializes a sempr::Core with a SeparateFileStorage "
-                "persistence module pointing to the given path."
+                throw std::invalid_argument("unknown backend: " + backend);
+            }),
+            py::arg("path"), py::arg("backend"),
+            "Initializes a sempr::Core with the given persistence backend: "
+            "'files' (one file per entity in the directory path, like "
+            "Core(path)) or 'log' (a single append-only log file at path)."
+        )
+        .def("compact",
+            [](PyCore& self)
+            {
+                auto log = self.logStorage();
+                if (!log) throw std::runtime_error("core does not persist to a log file");
+                self.storage()->flush();
+                log->compact();
+            },
+            py::call_guard<CoreLock>(),
+            "Rewrites the log file of the core with only the latest state of "
+            "each entity. Happens automatically when more than half of it is "
+            "outdated."
+        )
+        .def_property_readonly("loadStats",
+            [](const PyCore& self)
+            {
+                auto& stats = self.loadStats();
+                py::dict d;
+                d["entities"] = stats.entities;
+                d["threads"] = stats.threads;
+                d["seconds"] = stats.seconds;
+                return d;
+            },
+            "Number of entities loaded at startup, the number of threads used "
+            "and the time it took."
+        )
+        .def("setWriteBehind",
+            [](PyCore& self, double interval, size_t threshold)
+            {
+                auto storage = self.storage();
+                if (!storage) throw std::runtime_error("core has no persistence module");
+                storage->setWriteBehind(interval, threshold);
+            },
+            py::arg("interval"), py::arg("threshold") = 1000,
+            py::call_guard<CoreLock>(),
+            "Persists changed entities from a background thread, every "
+            "interval seconds or as soon as threshold entities are pending, "
+            "instead of on every change. An interval <= 0 switches back to "
+            "synchronous writes."
+        )
+        .def("flush",
+            [](PyCore& self)
+            {
+                if (auto storage = self.storage()) storage->flush();
+            },
+            py::call_guard<CoreLock>(),
+            "Writes all pending changes to the persistence module. This also "
+            "happens when the core is destroyed."
+        )
+        .def_property_readonly("pendingWrites",
+            [](PyCore& self)
+            {
+                auto storage = self.storage();
+                return storage ? storage->pending() : size_t(0);
+            },
+            "Number of entities with changes not yet written."
         )
-        .def("loadPlugins", py::overload_cast<>(&Core::loadPlugins))
+        .def("loadPlugins", py::overload_cast<>(&Core::loadPlugins), py::call_guard<CoreLock>())
         .def("query",
-            [](Core& core, const std::string& query)
+            [](PyCore& core, const std::string& query)
             {
                 auto rdf = core.getPlugin<RDFPlugin>();
                 if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
@@ -180,9 +851,115 @@ void initCore(py::module_& m)
 
                 rdf->soprano().answer(sq);
                 return sq.results;
-            })
+            },
+            py::call_guard<CoreLock>())
+        .def("prepare",
+            [](PyCore& core, const std::string& query)
+            {
+                return std::make_unique<PreparedQuery>(core, query);
+            },
+            py::keep_alive<0, 1>(),
+            "Prepares a SPARQL query with $parameters for repeated execution, "
+            "e.g. core.prepare('SELECT ?t WHERE { $e rdf:type ?t. }')"
+            ".execute(e='<sempr:Entity_1>')."
+        )
+        .def("queryIter",
+            [](PyCore& core, const std::string& query, size_t batchSize)
+            {
+                return std::make_unique<SPARQLCursor>(core, query, batchSize);
+            },
+            py::arg("query"), py::arg("batch_size") = 1000,
+            py::keep_alive<0, 1>(),
+            "Returns an iterator over the results of a SPARQL query. The query "
+            "is answered once, on first access; the rows are converted to "
+            "python batch_size at a time (see SPARQLCursor.nextBatch)."
+        )
+        .def("queryColumns",
+            [](PyCore& core, const std::string& query)
+            {
+                SPARQLQuery sq;
+                sq.query = query;
+                {
+                    CoreLock lock;
+                    auto rdf = core.getPlugin<RDFPlugin>();
+                    if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
+
+                    rdf->soprano().answer(sq);
+                }
+
+                const size_t numRows = sq.results.size();
+
+                // the columns of the projection, so that empty results keep
+                // their schema, and any other variable found in the results
+                std::vector<std::string> vars = projectedVariables(query);
+                std::unordered_map<std::string, size_t> columnOf;
+                for (size_t i = 0; i < vars.size(); i++) columnOf.emplace(vars[i], i);
+                for (auto& row : sq.results)
+                {
+                    for (auto& entry : row)
+                    {
+                        if (columnOf.emplace(entry.first, vars.size()).second)
+                            vars.push_back(entry.first);
+                    }
+                }
+
+                std::vector<py::list> values;
+                std::vector<py::array_t<int8_t>> types;
+                for (size_t i = 0; i < vars.size(); i++)
+                {
+                    values.emplace_back(numRows);
+                    types.emplace_back(numRows);
+                    std::fill_n(types.back().mutable_data(), numRows, int8_t(-1));
+                }
+
+                // every distinct value is converted to a python string once,
+                // shared with the term dictionary if it is interned there.
+                // Results are not interned, the dictionary is never freed.
+                auto& terms = TermDictionary::instance();
+                std::unordered_map<std::string, py::str> interned;
+                py::none unbound;
+
+                for (size_t r = 0; r < numRows; r++)
+                {
+                    auto& row = sq.results[r];
+                    for (size_t c = 0; c < vars.size(); c++)
+                    {
+                        auto entry = row.find(vars[c]);
+                        if (entry == row.end())
+                        {
+                            values[c][r] = unbound;
+                            continue;
+                        }
+
+                        auto it = interned.find(entry->second.second);
+                        if (it == interned.end())
+                        {
+                            TermDictionary::Handle handle;
+                            it = interned.emplace(entry->second.second,
+                                    terms.find(entry->second.second, handle) ?
+                                        terms.str(handle) : py::str(entry->second.second)).first;
+                        }
+
+                        values[c][r] = it->second;
+                        types[c].mutable_data()[r] = static_cast<int8_t>(entry->second.first);
+                    }
+                }
+
+                py::dict columns;
+                for (size_t c = 0; c < vars.size(); c++)
+                {
+                    columns[py::str(vars[c])] = py::make_tuple(values[c], types[c]);
+                }
+                return columns;
+            },
+            "Answers a SPARQL query in a columnar layout: A dict that maps "
+            "every variable to a tuple of (values, types). values is a list "
+            "of strings (None where unbound), in which equal values share the "
+            "same python object; types is a numpy int8 array of "
+            "SPARQLQuery.ValueType codes, -1 where unbound."
+        )
         .def("componentQuery",
-            [](Core& core, const std::string& query, const std::string& var)
+            [](PyCore& core, const std::string& query, const std::string& var)
             {
                 auto rdf = core.getPlugin<RDFPlugin>();
                 if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
@@ -190,10 +967,11 @@ void initCore(py::module_& m)
                 return rdf->componentQuery(query)
                     .with<Component>(var).includeInferred(true).aggregate()
                     .execute();
-            }
+            },
+            py::call_guard<CoreLock>()
         )
         .def("componentQuery",
-            [](Core& core, const std::string& query, const std::string& var0, const std::string& var1)
+            [](PyCore& core, const std::string& query, const std::string& var0, const std::string& var1)
             {
                 auto rdf = core.getPlugin<RDFPlugin>();
                 if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
@@ -202,53 +980,323 @@ void initCore(py::module_& m)
                     .with<Component>(var0).includeInferred(true).aggregate()
                     .with<Component>(var1).includeInferred(true).aggregate()
                     .execute();
-            }
+            },
+            py::call_guard<CoreLock>()
+        )
+        .def("componentQuery",
+            [](PyCore& core, const std::string& query, const py::dict& types)
+            {
+                std::vector<std::string> vars;
+                std::vector<component_filter_t> filters;
+                for (auto& item : types)
+                {
+                    vars.push_back(py::str(item.first));
+                    filters.push_back(componentFilterFor(item.second));
+                }
+
+                std::vector<std::vector<Component::Ptr>> components(vars.size());
+                {
+                    CoreLock lock;
+                    auto rdf = core.getPlugin<RDFPlugin>();
+                    if (!rdf) throw std::runtime_error("RDFPlugin not loaded");
+
+                    // the query is answered once, and the components of the
+                    // entities in every column are looked up from the
+                    // (asserted and inferred) ECWMEs, like componentQuery does
+                    SPARQLQuery sq;
+                    sq.query = query;
+                    rdf->soprano().answer(sq);
+
+                    std::unordered_map<std::string, std::vector<Component::Ptr>> byURI;
+                    for (auto& wme : core.wmeIndex()->wmes(WMEIndex::ECWME))
+                    {
+                        auto ecwme = std::static_pointer_cast<ECWME>(wme);
+                        auto& entity = std::get<0>(ecwme->value_);
+                        auto uri = entity->idIsURI() ? entity->id() : sempr::baseURI() + entity->id();
+                        byURI[uri].push_back(std::get<1>(ecwme->value_));
+                    }
+
+                    for (auto& row : sq.results)
+                    {
+                        for (size_t i = 0; i < vars.size(); i++)
+                        {
+                            auto value = row.find(vars[i]);
+                            if (value == row.end()) continue;
+
+                            auto entity = byURI.find(value->second.second);
+                            if (entity == byURI.end()) continue;
+
+                            for (auto& component : entity->second)
+                            {
+                                if (filters[i](component)) components[i].push_back(component);
+                            }
+                        }
+                    }
+                }
+
+                py::dict grouped;
+                for (size_t i = 0; i < vars.size(); i++)
+                {
+                    grouped[py::str(vars[i])] = py::cast(components[i]);
+                }
+                return grouped;
+            },
+            "Component query for any number of variables. Takes a dict that "
+            "maps each variable to the component type to look for (or None "
+            "for any), and returns a dict that maps each variable to a flat "
+            "list of the matching components of all result rows."
+        )
+        .def("spatialQuery",
+            [](PyCore& self, py::object geometry, const std::string& predicate)
+            {
+                auto query = py::isinstance<py::bytes>(geometry) ?
+                                readWKB(geometry.cast<std::string>()) :
+                                readWKT(geometry.cast<std::string>());
+
+                CoreLock lock;
+                return self.spatialIndex().query(*query, predicate);
+            },
+            py::arg("geometry"), py::arg("predicate") = "intersects",
+            "Returns all entities with a GeosGeometry component for which "
+            "component.<predicate>(geometry) holds, using a spatial index over "
+            "the geometries of all entities added to the core. geometry may be "
+            "given as WKT string or WKB bytes."
+        )
+        .def("spatialQueryMany",
+            [](PyCore& self, const std::vector<py::object>& geometries, const std::string& predicate)
+            {
+                std::vector<std::unique_ptr<geos::geom::Geometry>> queries;
+                queries.reserve(geometries.size());
+                for (auto& geometry : geometries)
+                {
+                    queries.push_back(py::isinstance<py::bytes>(geometry) ?
+                                        readWKB(geometry.cast<std::string>()) :
+                                        readWKT(geometry.cast<std::string>()));
+                }
+
+                std::vector<std::vector<Entity::Ptr>> results;
+                results.reserve(queries.size());
+                {
+                    CoreLock lock;
+                    auto& index = self.spatialIndex();
+                    for (auto& query : queries)
+                    {
+                        results.push_back(index.query(*query, predicate));
+                    }
+                }
+                return results;
+            },
+            py::arg("geometries"), py::arg("predicate") = "intersects",
+            "Batched spatialQuery: one list of entities per given geometry."
+        )
+        .def("setTransforms",
+            [](PyCore&, const std::vector<std::shared_ptr<AffineTransform>>& components,
+               py::array_t<double, py::array::c_style | py::array::forcecast> matrices)
+            {
+                if (matrices.ndim() != 3 || matrices.shape(1) != 4 || matrices.shape(2) != 4)
+                    throw std::invalid_argument("matrices must be of shape (K, 4, 4)");
+                if (static_cast<size_t>(matrices.shape(0)) != components.size())
+                    throw std::invalid_argument("need one matrix per component");
+
+                using Matrix = Eigen::Matrix<double, 4, 4, Eigen::RowMajor>;
+                const double* data = matrices.data();
+
+                CoreLock lock;
+                for (size_t i = 0; i < components.size(); i++)
+                {
+                    Eigen::Affine3d affine(Eigen::Map<const Matrix>(data + 16*i).eval());
+                    components[i]->setTransform(affine);
+                    components[i]->changed();
+                }
+            },
+            py::arg("components"), py::arg("matrices"),
+            "Sets the transforms of K AffineTransform components from a "
+            "(K, 4, 4) array, and marks them as changed -- all under a single "
+            "lock, to be propagated in one inference run."
+        )
+        .def("addRules", &Core::addRules, py::call_guard<CoreLock>())
+        .def("removeRule", &Core::removeRule, py::call_guard<CoreLock>())
+        .def("rules", &Core::rules, py::call_guard<CoreLock>())
+        .def("performInference", &PyCore::performInference)
+        .def("performInferenceAsync", &PyCore::performInferenceAsync,
+            "Runs inference on a background thread of this core. Returns a "
+            "concurrent.futures.Future, use asyncio.wrap_future to await it.")
+        .def("addEntity", &PyCore::addEntity, py::call_guard<CoreLock>())
+        .def("removeEntity", &PyCore::removeEntity, py::call_guard<CoreLock>())
+        .def("addEntities",
+            [](PyCore& self, const std::vector<Entity::Ptr>& entities)
+            {
+                for (auto& entity : entities)
+                {
+                    self.addEntity(entity);
+                }
+            },
+            py::call_guard<CoreLock>(),
+            "Adds all given entities at once. The list is converted in one "
+            "go and the core is locked only once. As always, the changes are "
+            "propagated in the next call to performInference."
+        )
+        .def("removeEntities",
+            [](PyCore& self, const std::vector<Entity::Ptr>& entities)
+            {
+                for (auto& entity : entities)
+                {
+                    self.removeEntity(entity);
+                }
+            },
+            py::call_guard<CoreLock>(),
+            "Removes all given entities at once, see addEntities."
         )
-        .def("addRules", &Core::addRules)
-        .def("removeRule", &Core::removeRule)
-        .def("rules", &Core::rules)
-        .def("performInference", &Core::performInference)
-        .def("addEntity", &Core::addEntity)
-        .def("removeEntity", &Core::removeEntity)
         .def_property_readonly("reasoner", &Core::reasoner)
+        .def("memoryUsage",
+            [](PyCore& self)
+            {
+                MemoryUsage usage;
+                {
+                    CoreLock lock;
+                    usage = MemoryUsage::of(self);
+                }
+                return usage.toPython();
+            },
+            "Estimated memory usage per subsystem: WMEs by type, evidences, "
+            "tokens held per rule, components by type (size of their binary "
+            "serialization), the number of triples in the RDF store and the "
+            "sizes of the caches of the bindings. A full pass over the "
+            "inference state, meant for monitoring, not for hot paths."
+        )
+        .def("startTrace",
+            [](PyCore&, const std::string& path) { Tracer::instance().start(path); },
+            "Starts recording spans of inference runs, python callbacks and "
+            "persistence, to be written to path as a Chrome trace (JSON) by "
+            "stopTrace. View it in chrome://tracing or ui.perfetto.dev."
+        )
+        .def("stopTrace",
+            [](PyCore&) { return Tracer::instance().stop(); },
+            py::call_guard<py::gil_scoped_release>(),
+            "Stops recording and writes the trace. Returns the number of spans."
+        )
+        .def("setProfiling",
+            [](PyCore& self, bool enabled) { self.profile().enabled = enabled; },
+            py::call_guard<CoreLock>(),
+            "Enables timing of the inference runs. Also records the net change "
+            "of evidences per production, which needs a pass over the "
+            "inference state before and after every run."
+        )
+        .def("profile",
+            [](PyCore& self)
+            {
+                InferenceProfile profile;
+                {
+                    CoreLock lock;
+                    profile = self.profile();
+                }
+
+                py::dict d;
+                d["runs"] = profile.runs;
+                d["seconds"] = profile.seconds;
+                d["lastSeconds"] = profile.lastSeconds;
+                d["maxSeconds"] = profile.maxSeconds;
+                d["evidenceChange"] = profile.evidenceChange;
+                return d;
+            },
+            "The profile of the inference runs since profiling was enabled."
+        )
+        .def("resetProfile",
+            [](PyCore& self)
+            {
+                bool enabled = self.profile().enabled;
+                self.profile() = InferenceProfile();
+                self.profile().enabled = enabled;
+            },
+            py::call_guard<CoreLock>()
+        )
         .def("explainAsDOT",
-            [](Core& self, const Triple& t)
+            [](PyCore& self, const Triple& t)
             {
-                rete::ExplanationToDotVisitor visitor;
                 auto toExplain = std::make_shared<rete::Triple>(
                         t.getField(Triple::Field::SUBJECT),
                         t.getField(Triple::Field::PREDICATE),
                         t.getField(Triple::Field::OBJECT)
                 );
 
-                self.reasoner()
-                    .getCurrentState()
-                    .traverseExplanation(toExplain, visitor);
-                return visitor.str();
-            }
+                return self.explainAsDOT(toExplain);
+            },
+            py::call_guard<CoreLock>(),
+            "Explanation of the triple in the DOT format. Cached until the "
+            "next inference run."
         )
         .def("explainAsJSON",
-            [](Core& self, const Triple& t) -> py::object
+            [](PyCore& self, const Triple& t) -> py::object
             {
-                rete::ExplanationToJSONVisitor visitor;
-                visitor.addToJSONConverter(std::make_shared<sempr::TupleWMEToJSONConverter>());
-                visitor.addToJSONConverter(std::make_shared<sempr::TupleGeoToJSONConverter>());
-                visitor.addToJSONConverter(std::make_shared<sempr::ECWMEToJSONConverter>());
-
+                CoreLock lock;
                 auto toExplain = std::make_shared<rete::Triple>(
                     t.getField(Triple::Field::SUBJECT),
                     t.getField(Triple::Field::PREDICATE),
                     t.getField(Triple::Field::OBJECT)
                 );
 
-                self.reasoner()
-                    .getCurrentState()
-                    .traverseExplanation(toExplain, visitor);
-                return visitor.json();
-            }
+                auto& json = self.explainAsJSON(toExplain);
+
+                // convert the cached json directly, the GIL may be acquired
+                // while holding the sempr mutex
+                py::gil_scoped_acquire gil;
+                return pyjson::from_json(json);
+            },
+            "Explanation of the triple as JSON. Cached until the next "
+            "inference run."
+        )
+        .def("explainAsJSONBytes",
+            [](PyCore& self, const Triple& t, int indent)
+            {
+                std::string str;
+                {
+                    CoreLock lock;
+                    auto toExplain = std::make_shared<rete::Triple>(
+                        t.getField(Triple::Field::SUBJECT),
+                        t.getField(Triple::Field::PREDICATE),
+                        t.getField(Triple::Field::OBJECT)
+                    );
+
+                    str = self.explainAsJSON(toExplain).dump(indent);
+                }
+                return py::bytes(str);
+            },
+            py::arg("triple"), py::arg("indent") = -1,
+            "Like explainAsJSON, but returns the serialized JSON document "
+            "(utf-8) instead of python objects, e.g. to forward it as is."
+        )
+        .def("explainMany",
+            [](PyCore& self, const std::vector<Triple>& triples, size_t maxDepth)
+            {
+                ExplanationGraph graph;
+                std::vector<int32_t> roots;
+                roots.reserve(triples.size());
+                {
+                    CoreLock lock;
+                    auto& state = self.reasoner().getCurrentState();
+                    for (auto& t : triples)
+                    {
+                        auto toExplain = std::make_shared<rete::Triple>(
+                            t.getField(Triple::Field::SUBJECT),
+                            t.getField(Triple::Field::PREDICATE),
+                            t.getField(Triple::Field::OBJECT)
+                        );
+                        roots.push_back(graph.add(state, toExplain, maxDepth));
+                    }
+                }
+
+                auto result = graph.toPython();
+                result["roots"] = py::array_t<int32_t>(roots.size(), roots.data());
+                return result;
+            },
+            py::arg("triples"), py::arg("maxDepth") = std::numeric_limits<size_t>::max(),
+            "Explains all triples at once, as a single graph in which shared "
+            "derivations are contained -- and traversed -- only once. Same "
+            "format as InferenceState.explanationGraph, plus roots: the node "
+            "of each triple."
         )
         .def("registerCallbackEffect",
-            [](Core& self, py::object pycb, const std::string& name)
+            [](PyCore& self, py::object pycb, const std::string& name)
             {
                 py::module inspect_module = py::module::import("inspect");
                 py::object result = inspect_module.attr("signature")(pycb).attr("parameters");
@@ -256,27 +1304,35 @@ void initCore(py::module_& m)
 
                 std::cout << "inspect py func -> " << num_params << std::endl;
 
+                // the callbacks are created with the GIL held, only the
+                // registration at the parser needs the core
+                auto registerBuilder = [&self](auto builder)
+                {
+                    CoreLock lock;
+                    self.parser().registerNodeBuilder(std::move(builder));
+                };
+
                 if (num_params == 1)
                 {
-                    self.parser().registerNodeBuilder(
+                    registerBuilder(
                         rete::makeCallbackBuilder(name,
-                            makeCallback<>(pycb)
+                            makeCallback<>(name, pycb)
                         )
                     );
                 }
                 else if (num_params == 2)
                 {
-                    self.parser().registerNodeBuilder(
+                    registerBuilder(
                         rete::makeCallbackBuilder(name,
-                            makeCallback<std::string>(pycb)
+                            makeCallback<std::string>(name, pycb)
                         )
                     );
                 }
                 else if (num_params == 3)
                 {
-                    self.parser().registerNodeBuilder(
+                    registerBuilder(
                         rete::makeCallbackBuilder(name,
-                            makeCallback<std::string, std::string>(pycb)
+                            makeCallback<std::string, std::string>(name, pycb)
                         )
                     );
                 }
@@ -286,6 +1342,54 @@ void initCore(py::module_& m)
                 }
             }
         )
+        .def("registerBatchedCallbackEffect",
+            [](PyCore& self, py::object pycb, const std::string& name, size_t numArgs, bool columnar)
+            {
+                auto batch = std::make_shared<CallbackBatch>(pycb, numArgs, columnar);
+
+                auto registerBuilder = [&self](auto builder)
+                {
+                    CoreLock lock;
+                    self.parser().registerNodeBuilder(std::move(builder));
+                };
+
+                if (numArgs == 0)
+                {
+                    registerBuilder(
+                        rete::makeCallbackBuilder(name,
+                            makeBatchedCallback<>(batch)
+                        )
+                    );
+                }
+                else if (numArgs == 1)
+                {
+                    registerBuilder(
+                        rete::makeCallbackBuilder(name,
+                            makeBatchedCallback<std::string>(batch)
+                        )
+                    );
+                }
+                else if (numArgs == 2)
+                {
+                    registerBuilder(
+                        rete::makeCallbackBuilder(name,
+                            makeBatchedCallback<std::string, std::string>(batch)
+                        )
+                    );
+                }
+                else
+                {
+                    throw py::type_error("Callbacks with more than 2 arguments are not supported.");
+                }
+
+                self.addCallbackBatch(batch);
+            },
+            py::arg("callback"), py::arg("name"), py::arg("numArgs"), py::arg("columnar") = false,
+            "Registers a callback effect whose firings are collected during "
+            "inference and passed to the callback in a single call afterwards: "
+            "a list of (flag, args...) tuples, or a tuple of lists "
+            "([flags], [arg0s], ...) if columnar is set."
+        )
         ;
 
     // ECWME
@@ -18,12 +18,76 @@
 #include <sempr/TupleGeoToJSONConverter.hpp>
 
 #include "external/pybind11_json.hpp"
+#include "Threading.hpp"
+#include "PyCore.hpp"
+#include "ExplanationGraph.hpp"
+#include "WMEIndex.hpp"
+#include "NetworkStats.hpp"
+#include "Tracer.hpp"
+#include "TermDictionary.hpp"
 
 
 namespace py = pybind11;
 using namespace rete;
 
 
+// a field of a triple pattern: None and variables (?x) are wildcards
+std::string patternField(py::handle field)
+{
+    if (field.is_none()) return "";
+    auto str = field.cast<std::string>();
+    return (!str.empty() && str[0] == '?') ? "" : str;
+}
+
+
+// drops everything derived from the state of the reasoner, after it has been
+// modified directly
+void stateChanged(Reasoner& reasoner)
+{
+    if (auto core = PyCore::of(reasoner)) core->stateChanged();
+}
+
+
+// the index of the state: the one of the owning core, or a new one for
+// reasoners that are not owned by a core. Needs the sempr mutex.
+WMEIndex::Ptr indexOf(const InferenceState& state)
+{
+    if (auto core = PyCore::of(state)) return core->wmeIndex();
+    return std::make_shared<WMEIndex>(state);
+}
+
+
+// type filter for WMEs, by name or by python type
+WMEIndex::Kind wmeKind(py::handle type)
+{
+    if (py::isinstance<py::str>(type)) return WMEIndex::kindByName(type.cast<std::string>());
+    return WMEIndex::kindByName(type.attr("__name__").cast<std::string>());
+}
+
+
+// lazy iteration over the matches of a triple pattern
+class TripleIterator {
+public:
+    TripleIterator(WMEIndex::Ptr index, std::vector<uint32_t> matches)
+        : index_(index), matches_(std::move(matches))
+    {
+    }
+
+    Triple::Ptr next()
+    {
+        if (pos_ >= matches_.size()) throw py::stop_iteration();
+        return index_->triples()[matches_[pos_++]];
+    }
+
+    size_t size() const { return matches_.size() - pos_; }
+
+private:
+    WMEIndex::Ptr index_;
+    std::vector<uint32_t> matches_;
+    size_t pos_ = 0;
+};
+
+
 // helper stuff to properly expose ExplanationVisitors
 // (and allow subclassing them _in python_!)
 class PyExplanationVisitor : public ExplanationVisitor {
@@ -76,20 +140,30 @@ void initRete(py::module_& m)
 
     py::class_<Triple, std::shared_ptr<Triple>, WME>(m, "Triple")
         .def(py::init<const std::string&, const std::string&, const std::string&>())
-        .def_readonly("subject", &Triple::subject)
-        .def_readonly("predicate", &Triple::predicate)
-        .def_readonly("object", &Triple::object)
+        // terms are returned as interned strs, see sempr.terms
+        .def_property_readonly("subject", [](const Triple& t) { return TermDictionary::instance().str(t.subject); })
+        .def_property_readonly("predicate", [](const Triple& t) { return TermDictionary::instance().str(t.predicate); })
+        .def_property_readonly("object", [](const Triple& t) { return TermDictionary::instance().str(t.object); })
         .def("getField", &Triple::getField)
         .def_static("fieldName", &Triple::fieldName)
         .def("__getitem__",
             [](const Triple& t, size_t index)
             {
-                if (index == 0) return t.subject;
-                if (index == 1) return t.predicate;
-                if (index == 2) return t.object;
+                auto& terms = TermDictionary::instance();
+                if (index == 0) return terms.str(t.subject);
+                if (index == 1) return terms.str(t.predicate);
+                if (index == 2) return terms.str(t.object);
                 throw py::index_error();
             }
         )
+        .def_property_readonly("handles",
+            [](const Triple& t)
+            {
+                auto& terms = TermDictionary::instance();
+                return py::make_tuple(terms.intern(t.subject), terms.intern(t.predicate), terms.intern(t.object));
+            },
+            "(subject, predicate, object) as handles of sempr.terms."
+        )
     ;
 
     // Token
@@ -180,47 +254,218 @@ void initRete(py::module_& m)
         {
             return visitor.json();
         })
+        .def("jsonBytes",
+            [](const ExplanationToJSONVisitor& visitor, int indent)
+            {
+                std::string str;
+                {
+                    py::gil_scoped_release release;
+                    str = visitor.json().dump(indent);
+                }
+                return py::bytes(str);
+            },
+            py::arg("indent") = -1,
+            "The serialized JSON document (utf-8), without building python "
+            "objects."
+        )
+    ;
+
+    py::class_<TripleIterator>(m, "TripleIterator")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", &TripleIterator::next)
+        .def("__len__", &TripleIterator::size)
     ;
 
     // InferenceState
+    // pattern lookups are answered from the WMEIndex of the owning core, which
+    // is built once per state of the inference
+    auto findTriples = [](const InferenceState& state, py::handle s, py::handle p, py::handle o,
+                          bool inferredOnly)
+    {
+        auto ss = patternField(s), ps = patternField(p), os = patternField(o);
+
+        CoreLock lock;
+        auto index = indexOf(state);
+        return std::make_pair(index, index->find(state, ss, ps, os, inferredOnly));
+    };
+
     py::class_<InferenceState>(m, "InferenceState")
         .def("explain",
             [](const InferenceState& state, WME::Ptr wme)
             {
                 auto expl = state.explain(wme);
                 return expl.evidences_;
-            }
+            },
+            py::call_guard<CoreLock>()
         )
         .def("explainedBy",
             [](const InferenceState& state, Evidence::Ptr evidence)
             {
                 auto expl = state.explainedBy(evidence);
                 return expl.wmes_;
-            }
+            },
+            py::call_guard<CoreLock>()
+        )
+        .def_property_readonly("numWMEs", py::cpp_function(&InferenceState::numWMEs, py::call_guard<CoreLock>()))
+        .def_property_readonly("numEvidences", py::cpp_function(&InferenceState::numEvidences, py::call_guard<CoreLock>()))
+        .def("getWMEs", &InferenceState::getWMEs, py::call_guard<CoreLock>())
+        .def("getWMEs",
+            [](const InferenceState& state, py::handle type)
+            {
+                auto kind = wmeKind(type);
+                CoreLock lock;
+                return indexOf(state)->wmes(kind);
+            },
+            py::arg("type"),
+            "All WMEs of the given type: Triple, ECWME, TokenGroup (or their "
+            "names), or WME for all."
+        )
+        .def("countWMEs",
+            [](const InferenceState& state, py::handle type)
+            {
+                auto kind = wmeKind(type);
+                CoreLock lock;
+                return indexOf(state)->wmes(kind).size();
+            },
+            py::arg("type")
+        )
+        .def("findTriples",
+            [findTriples](const InferenceState& state, py::handle s, py::handle p, py::handle o,
+                          bool inferredOnly)
+            {
+                auto found = findTriples(state, s, p, o, inferredOnly);
+                std::vector<Triple::Ptr> triples;
+                triples.reserve(found.second.size());
+                for (auto pos : found.second) triples.push_back(found.first->triples()[pos]);
+                return triples;
+            },
+            py::arg("s") = py::none(), py::arg("p") = py::none(), py::arg("o") = py::none(),
+            py::arg("inferredOnly") = false,
+            "All triples matching the pattern, None or ?variables are "
+            "wildcards. With inferredOnly, asserted triples are skipped."
+        )
+        .def("countTriples",
+            [findTriples](const InferenceState& state, py::handle s, py::handle p, py::handle o,
+                          bool inferredOnly)
+            {
+                return findTriples(state, s, p, o, inferredOnly).second.size();
+            },
+            py::arg("s") = py::none(), py::arg("p") = py::none(), py::arg("o") = py::none(),
+            py::arg("inferredOnly") = false,
+            "Number of triples matching the pattern, see findTriples."
+        )
+        .def("iterTriples",
+            [findTriples](const InferenceState& state, py::handle s, py::handle p, py::handle o,
+                          bool inferredOnly)
+            {
+                auto found = findTriples(state, s, p, o, inferredOnly);
+                return TripleIterator(found.first, std::move(found.second));
+            },
+            py::arg("s") = py::none(), py::arg("p") = py::none(), py::arg("o") = py::none(),
+            py::arg("inferredOnly") = false,
+            "Like findTriples, but creates the python objects only while "
+            "iterating."
+        )
+        // python visitors re-acquire the GIL in their overrides
+        .def("traverseExplanation", &InferenceState::traverseExplanation, py::call_guard<CoreLock>())
+        .def("explanationGraph",
+            [](const InferenceState& state, WME::Ptr wme, size_t maxDepth)
+            {
+                ExplanationGraph graph;
+                {
+                    CoreLock lock;
+                    graph.add(state, wme, maxDepth);
+                }
+                return graph.toPython();
+            },
+            py::arg("wme"), py::arg("maxDepth") = std::numeric_limits<size_t>::max(),
+            "Walks the explanation of the wme natively and returns it as a flat "
+            "graph: a dict of numpy arrays kind, label (index into strings) and "
+            "depth per node, edges (E, 2) and edgeKind per edge, and the lists "
+            "strings, nodeKinds and edgeKinds. Node 0 is the wme."
         )
-        .def_property_readonly("numWMEs", &InferenceState::numWMEs)
-        .def_property_readonly("numEvidences", &InferenceState::numEvidences)
-        .def("getWMEs", &InferenceState::getWMEs)
-        .def("traverseExplanation", &InferenceState::traverseExplanation)
     ;
 
     // Reasoner
     py::class_<Reasoner>(m, "Reasoner")
         .def(py::init<>())
         .def(py::init<size_t>())
-        .def("performInference", &Reasoner::performInference)
-        .def("addEvidence", &Reasoner::addEvidence)
-        .def("removeEvidence", py::overload_cast<WME::Ptr, Evidence::Ptr>(&Reasoner::removeEvidence))
-        .def("removeEvidence", py::overload_cast<Evidence::Ptr>(&Reasoner::removeEvidence))
+        .def("performInference",
+            [](Reasoner& self)
+            {
+                // the firings of batched callbacks of the owning core are
+                // delivered just like after Core.performInference
+                PyCore* core = nullptr;
+                PyCore::PendingFirings pending;
+                std::exception_ptr error;
+                {
+                    CoreLock lock;
+                    TraceSpan span("inference", "Reasoner.performInference");
+                    try
+                    {
+                        // the state changes even if an effect throws halfway
+                        struct Invalidate {
+                            Reasoner& reasoner;
+                            ~Invalidate() { stateChanged(reasoner); }
+                        } invalidate{ self };
+                        self.performInference();
+                    }
+                    catch (...)
+                    {
+                        error = std::current_exception();
+                    }
+
+                    // also the firings of a failed run
+                    core = PyCore::of(self);
+                    if (core) pending = core->takeCallbackFirings();
+                }
+
+                if (core) core->deliverCallbackFirings(pending, error);
+                else if (error) std::rethrow_exception(error);
+            })
+        .def("addEvidence",
+            [](Reasoner& self, WME::Ptr wme, Evidence::Ptr evidence) { self.addEvidence(wme, evidence); stateChanged(self); },
+            py::call_guard<CoreLock>())
+        .def("removeEvidence",
+            [](Reasoner& self, WME::Ptr wme, Evidence::Ptr evidence) { self.removeEvidence(wme, evidence); stateChanged(self); },
+            py::call_guard<CoreLock>())
+        .def("removeEvidence",
+            [](Reasoner& self, Evidence::Ptr evidence) { self.removeEvidence(evidence); stateChanged(self); },
+            py::call_guard<CoreLock>())
         .def_property_readonly("network", py::overload_cast<>(&Reasoner::net))
         .def_property_readonly("inferenceState", &Reasoner::getCurrentState)
+        .def("stats",
+            [](Reasoner& self)
+            {
+                NetworkStats stats;
+                {
+                    CoreLock lock;
+                    stats = NetworkStats::of(self.getCurrentState());
+                }
+                return stats.toPython();
+            },
+            "Per production: the number of evidences it holds, the WMEs they "
+            "support, the tokens they keep alive and an estimate of their "
+            "memory in bytes. Also lists (from, to, count) dependencies: how "
+            "many WMEs inferred by one production are matched by another."
+        )
+        .def("statsDOT",
+            [](Reasoner& self)
+            {
+                CoreLock lock;
+                return NetworkStats::of(self.getCurrentState()).toDot();
+            },
+            "The productions and their dependencies as a DOT graph, colored "
+            "by the number of evidences they hold."
+        )
         .def("explainAsDOT",
             [](Reasoner& self, WME::Ptr toExplain)
             {
                 ExplanationToDotVisitor visitor;
                 self.getCurrentState().traverseExplanation(toExplain, visitor);
                 return visitor.str();
-            }
+            },
+            py::call_guard<CoreLock>()
         )
     ;
 }
\ No newline at end of file
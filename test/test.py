@@ -78,6 +78,18 @@ for i in range(5):
     res = core.query('SELECT ?e ?num WHERE { ?e <ex:hasNumComps> ?num . }')
     print(res)
 
+# results can also be streamed in batches
+for row in core.queryIter('SELECT ?e ?num WHERE { ?e <ex:hasNumComps> ?num . }', 2):
+    print(row)
+
+
+# bulk insertion and removal
+many = [sempr.Entity() for i in range(100)]
+core.addEntities(many)
+core.performInference()
+core.removeEntities(many)
+core.performInference()
+
 
 # remove the entity
 print('remove entity')
@@ -98,6 +110,11 @@ for r in res:
         print(f'-- {c.component} {c.isInferred} {c.tag}')
 
 
+# n-ary component query with type filters, grouped per variable
+grouped = core.componentQuery('SELECT ?e ?num WHERE { ?e <ex:hasNumComps> ?num . }', {'e': sempr.Component})
+print(grouped['e'])
+
+
 # AffineTransform
 import numpy as np
 a1 = sempr.AffineTransform() # default: identity
@@ -113,6 +130,28 @@ a2 = sempr.AffineTransform()
 a2.fromJSON(a1.toJSON())
 print(a2.transform)
 
+# transform points in place
+points = np.random.rand(5, 3)
+a1.apply(points)
+print(points)
+
+try:
+    a1.apply(points.astype(np.float32)) # would only transform a copy
+except TypeError as e:
+    print('TypeError:', e)
+
+# update many transforms at once
+e3 = sempr.Entity()
+transforms = [sempr.AffineTransform() for i in range(3)]
+for t in transforms:
+    e3.addComponent(t)
+core.addEntity(e3)
+mats = np.tile(np.identity(4), (3, 1, 1))
+mats[:, 0:3, 3] = [[1, 0, 0], [0, 1, 0], [0, 0, 1]]
+core.setTransforms(transforms, mats)
+core.performInference()
+print(transforms[1].transform)
+
 # GeosGeometry
 g1 = sempr.GeosGeometry()
 print(g1.toJSON())
@@ -131,6 +170,17 @@ except Exception as e:
 
 print(g1)
 
+# binary and numpy i/o, without going through text
+g3 = sempr.GeosGeometry(g2.wkb)
+print(g3.geometry)
+
+line = sempr.GeosGeometry.fromCoordinates(np.array([[0, 0], [1, 1], [2, 0]]), 'LineString')
+print(line.geometry)
+print(line.coordinates)
+view = line.coordinatesView()
+line.geometry = 'POINT (5 5)'
+print(view) # still the coordinates of the line
+
 
 # Triples
 t1 = sempr.Triple('<ex:foo>', '<ex:bar>', '<ex:bazzz>')
@@ -167,6 +217,11 @@ tv.add(sempr.Triple('a', 'b', 'c'))
 
 showVector(tv)
 
+# bulk insertion
+tv.extend([('<ex:a>', '<ex:b>', f'<ex:c_{i}>') for i in range(3)])
+tv.extend(['<ex:x>', '<ex:x>'], ['<ex:y>', '<ex:y>'], ['<ex:z_0>', '<ex:z_1>'])
+showVector(sempr.TripleVector(tv.triples()))
+
 
 
 # TriplePropertyMap
@@ -205,4 +260,50 @@ core.registerCallbackEffect(myFancyCallback, "myCB")
 core.addRules(
     '[testCB: EC<Component>(?e ?c), GROUP BY (?e) -> myCB(?e)]'
 )
-core.performInference()
\ No newline at end of file
+core.performInference()
+
+# binary serialization, also used by pickle / multiprocessing
+import pickle
+data = entity.toBytes()
+copy = sempr.Entity()
+copy.fromBytes(data)
+print(f'{len(data)} bytes, {len(copy.components)} components')
+
+for c in [m, tv, a1, g2]:
+    c2 = pickle.loads(pickle.dumps(c))
+    print(f'{type(c2).__name__}: {c2.toJSON() == c.toJSON()}')
+
+e4 = pickle.loads(pickle.dumps(entity))
+print(e4.id, e4.components)
+
+# parallel startup from the same database
+core2 = sempr.Core('testdb', threads=4, progress=lambda done, total: print(f'loaded {done}/{total}'))
+print(core2.loadStats)
+
+# write-behind persistence
+core.setWriteBehind(0.5, threshold=100)
+e = sempr.Entity()
+core.addEntity(e)
+e.addComponent(sempr.TripleVector())
+print(core.pendingWrites)
+core.flush()
+print(core.pendingWrites)
+core.setWriteBehind(0)
+
+# single file log backend
+logcore = sempr.Core('testdb.log', backend='log')
+logcore.loadPlugins()
+e = sempr.Entity()
+logcore.addEntity(e)
+e.addComponent(sempr.TripleVector([('<a>', '<b>', '<c>')]))
+logcore.compact()
+print(logcore.loadStats)
+
+# interned terms and handles
+t = sempr.Triple('<ex:a>', '<ex:b>', '<ex:c>')
+print(t.subject is sempr.Triple('<ex:a>', '<ex:x>', '<ex:y>').subject)
+s, p, o = t.handles
+print(sempr.terms.term(p), sempr.Triple.fromHandles(s, p, o))
+tv = sempr.TripleVector([t])
+tv.extendHandles(tv.handles())
+print(len(tv), sempr.terms.size())
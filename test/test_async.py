@@ -0,0 +1,72 @@
+import semprpy as sempr
+from semprpy import rete
+import asyncio
+import threading
+import time
+
+core = sempr.Core()
+core.loadPlugins()
+
+# the callback is executed on the inference thread -- the GIL is only
+# re-acquired when it actually fires
+def onType(flag: rete.PropagationFlag, entity: str):
+    print(f'{threading.current_thread().name}: {flag} {entity}')
+
+core.registerCallbackEffect(onType, 'onType')
+core.addRules('[EC<Component>(?e ?c) -> onType(?e)]')
+
+for i in range(100):
+    e = sempr.Entity()
+    e.addComponent(sempr.Component())
+    core.addEntity(e)
+
+# other python threads keep running while a blocking inference is performed
+ticks = 0
+stop = False
+def ticker():
+    global ticks
+    while not stop:
+        ticks += 1
+        time.sleep(0.001)
+
+t = threading.Thread(target=ticker)
+t.start()
+core.performInference()
+stop = True
+t.join()
+print(f'ticks during inference: {ticks}')
+
+
+# asynchronous inference, returns a concurrent.futures.Future
+future = core.performInferenceAsync()
+future.result()
+print('async inference done')
+
+# ... which can be awaited in asyncio
+async def main():
+    e = sempr.Entity()
+    e.addComponent(sempr.Component())
+    core.addEntity(e)
+    await asyncio.wrap_future(core.performInferenceAsync())
+    print('awaited inference done')
+
+asyncio.run(main())
+
+
+# batched callback effects: all firings of an inference run in one call
+def onTypeBatch(firings):
+    print(f'{len(firings)} firings, first: {firings[0]}')
+
+def onTypeColumns(columns):
+    flags, entities = columns
+    print(f'{len(flags)} firings, columnar')
+
+core.registerBatchedCallbackEffect(onTypeBatch, 'onTypeBatch', 1)
+core.registerBatchedCallbackEffect(onTypeColumns, 'onTypeColumns', 1, columnar=True)
+core.addRules('[EC<Component>(?e ?c) -> onTypeBatch(?e), onTypeColumns(?e)]')
+core.performInference()
+
+# record a chrome trace of an inference run
+core.startTrace('trace.json')
+core.performInference()
+print(core.stopTrace(), 'spans')
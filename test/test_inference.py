@@ -51,6 +51,13 @@ for t in c1.iter_triples():
 
 core.performInference()
 
+# re-assigning the same value does not modify the map, and
+# changed(onlyIfModified=True) skips the propagation of unmodified components
+c1[rdf.baseURI() + 'type'] = 'sempr:C', True
+c1.changed(onlyIfModified=True)
+c1.changed()
+core.performInference()
+
 q = f'SELECT * WHERE {{ sempr:{e1.id} rdf:type ?t. }}'
 print(q)
 result = core.query(q)
@@ -58,6 +65,29 @@ for r in result:
     l = [(k, *r[k]) for k in r]
     print(l)
 
+# columnar results: one list of values and one array of type codes per variable
+columns = core.queryColumns(q)
+values, types = columns['t']
+print(values, types)
+
+# empty results keep the columns of the projection
+print(core.queryColumns('SELECT ?s ?o WHERE { ?s <ex:nothing> ?o . }')) # {'s': ([], []), 'o': ([], [])}
+
+# prepared queries are split into parts once, and executed with bound
+# $parameters. Values that are no IRI or prefixed name become string literals
+prepared = core.prepare('SELECT ?t WHERE { $e rdf:type ?t. }')
+print(prepared.bind(e=f'sempr:{e1.id}'))
+print(prepared.execute(e=f'sempr:{e1.id}'))
+print(prepared.bind(e='foo" } ; DROP ALL #')) # a single, escaped literal
+class Sneaky(int):
+    def __str__(self): return '<ex:injected>'
+print(prepared.bind(e=Sneaky(3))) # formatted from the value: 3
+print(prepared.bind(e=float('-inf'))) # "-INF"^^xsd:double
+try:
+    prepared.bind(t='<ex:foo>')
+except KeyError as e:
+    print('KeyError:', e)
+
 # explain the first result!
 #              <entity URI>      expanded rdf:type            <?t>
 toExplain = sempr.Triple(f'<sempr:{e1.id}>',     rdf.type(),      f'<{result[0]["t"][1]}>')
@@ -111,4 +141,44 @@ with open('test.json', 'w+') as f:
 
 print(core.explainAsJSON(
     sempr.Triple(*wmes[2])
-))
\ No newline at end of file
+))
+# the same explanation as a flat graph of numpy arrays, without visitors
+graph = state.explanationGraph(wmes[2], maxDepth=5)
+for (a, b), kind in zip(graph['edges'], graph['edgeKind']):
+    print(graph['strings'][graph['label'][a]], graph['edgeKinds'][kind], graph['strings'][graph['label'][b]])
+
+# explanations are cached until the inference state changes, which includes
+# adding and removing entities and components; explainMany combines the
+# explanations of many triples into one graph
+print(core.explainAsJSON(sempr.Triple(*wmes[2])) == core.explainAsJSON(sempr.Triple(*wmes[2])))
+before = core.explainAsJSON(toExplain)
+e1.removeComponent(c1)
+print(core.explainAsJSON(toExplain) != before) # True, the evidence of the component is gone
+e1.addComponent(c1)
+core.performInference()
+many = core.explainMany([sempr.Triple(*w) for w in wmes if isinstance(w, rete.Triple)])
+print(len(many['kind']), many['roots'])
+
+# serialized json, e.g. to forward it to a web server as is
+print(json.loads(core.explainAsJSONBytes(sempr.Triple(*wmes[2]))) == core.explainAsJSON(sempr.Triple(*wmes[2])))
+v = rete.ExplanationToJSONVisitor()
+state.traverseExplanation(wmes[2], v)
+print(len(v.jsonBytes()))
+
+# pattern lookups on the inference state, answered from an index
+print(state.findTriples(p=rdf.type(), inferredOnly=True))
+print(state.countTriples('?x', rdfs.subClassOf(), None))
+for t in state.iterTriples(o='<sempr:A>'):
+    print(t)
+print(state.countWMEs(rete.TokenGroup), len(state.getWMEs('ECWME')))
+
+# statistics of the productions, and an opt-in profile of inference runs
+core.setProfiling(True)
+core.performInference()
+print(core.profile())
+print(core.reasoner.stats())
+with open('stats.dot', 'w+') as f:
+    f.write(core.reasoner.statsDOT())
+
+# estimated memory per subsystem
+print(core.memoryUsage())
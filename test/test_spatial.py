@@ -0,0 +1,31 @@
+import semprpy as sempr
+
+core = sempr.Core()
+core.loadPlugins()
+
+# a grid of 10x10 unit squares
+for x in range(10):
+    for y in range(10):
+        e = sempr.Entity()
+        e.addComponent(sempr.GeosGeometry(
+            f'POLYGON (({x} {y}, {x+1} {y}, {x+1} {y+1}, {x} {y+1}, {x} {y}))'
+        ))
+        core.addEntity(e)
+
+# the spatial index tracks the entities of the core, no inference needed
+
+hits = core.spatialQuery('POLYGON ((2.5 2.5, 4.5 2.5, 4.5 4.5, 2.5 4.5, 2.5 2.5))')
+print(f'intersects: {len(hits)}') # 9
+
+window = sempr.GeosGeometry('POLYGON ((0 0, 3 0, 3 3, 0 3, 0 0))')
+print(f'within: {len(core.spatialQuery(window.wkb, "within"))}') # 9
+
+print([len(r) for r in core.spatialQueryMany(['POINT (0.5 0.5)', 'POINT (20 20)'])]) # [1, 0]
+
+# replacing a geometry moves the entity in the index
+first = core.spatialQuery('POINT (0.5 0.5)')[0]
+first.components[0][0].geometry = 'POINT (50 50)'
+print(len(core.spatialQuery('POINT (0.5 0.5)')), len(core.spatialQuery('POINT (50 50)'))) # 0 1
+
+core.removeEntity(first)
+print(len(core.spatialQuery('POINT (50 50)'))) # 0